@@ -28,12 +28,28 @@ HEADERS += src/mainwindow.h src/utils.h \
     src/tempscheduler.h \
     src/cfg.h \
     src/RangeSlider.h \
+    src/tilegrid.h \
+    src/pixelformat.h \
+    src/reduce.h \
+    src/workerpool.h \
+    src/sampler.h \
+    src/srgb.h \
+    src/brfilter.h \
+    src/analysis.h \
+    src/gammacompositor.h \
     src/defs.h
 
 SOURCES += src/main.cpp src/mainwindow.cpp src/utils.cpp \
     src/tempscheduler.cpp \
     src/cfg.cpp \
-    src/RangeSlider.cpp
+    src/RangeSlider.cpp \
+    src/tilegrid.cpp \
+    src/reduce.cpp \
+    src/workerpool.cpp \
+    src/sampler.cpp \
+    src/brfilter.cpp \
+    src/analysis.cpp \
+    src/gammacompositor.cpp
 
 FORMS   += src/mainwindow.ui \
     src/tempscheduler.ui \
@@ -48,7 +64,7 @@ win32:{
 unix:{
     HEADERS += src/x11.h
     SOURCES += src/x11.cpp
-    LIBS += -lX11 -lXxf86vm
+    LIBS += -lX11 -lXext -lXdamage -lXfixes -lXrender -lXrandr -lXcomposite -lXxf86vm -lxcb -lxcb-present
 }
 
 RESOURCES += res.qrc
@@ -0,0 +1,43 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+// Runs fn a number of times and prints the median and fastest time per run, in ms
+inline double timeRuns(const char *label, unsigned runs, const std::function<void()> &fn)
+{
+	using namespace std::chrono;
+
+	std::vector<double> ms;
+
+	fn(); // Warm up caches, segments and dispatch
+
+	for (unsigned i = 0; i < runs; ++i)
+	{
+		const auto start = steady_clock::now();
+		fn();
+		ms.push_back(duration<double, std::milli>(steady_clock::now() - start).count());
+	}
+
+	std::sort(ms.begin(), ms.end());
+
+	const double median = ms[ms.size() / 2];
+
+	printf("%-32s median %8.3f ms, min %8.3f ms (%u runs)\n", label, median, ms.front(), runs);
+
+	return median;
+}
+
+int benchCapture(unsigned runs);
+int benchMetrics(unsigned runs);
+
+#endif // BENCH_H
@@ -0,0 +1,30 @@
+#-------------------------------------------------
+#
+# Benchmarks of the capture and reduction paths.
+# Build with: qmake && make, then run ./bench <name>
+#
+#-------------------------------------------------
+
+TARGET = bench
+TEMPLATE = app
+
+CONFIG += console c++1z optimize_full
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ../src ../includes
+
+HEADERS += bench.h
+
+SOURCES += main.cpp \
+    bench_capture.cpp \
+    bench_metrics.cpp \
+    ../src/utils.cpp \
+    ../src/reduce.cpp \
+    ../src/tilegrid.cpp \
+    ../src/workerpool.cpp
+
+unix:{
+    HEADERS += ../src/x11.h
+    SOURCES += ../src/x11.cpp
+    LIBS += -lX11 -lXext -lXdamage -lXfixes -lXrender -lXrandr -lXcomposite -lXxf86vm -lxcb -lxcb-present
+}
@@ -0,0 +1,96 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "bench.h"
+
+#ifndef _WIN32
+
+#include "x11.h"
+#include "reduce.h"
+#include <cstring>
+#include <vector>
+
+/**
+ * Per-frame cost of a full-screen capture plus the channel sums: the original path
+ * (XGetImage, copy into a buffer, destroy), then the MIT-SHM segment and the in-place XGetImage fallback.
+ * Needs a running X server (Xvfb works).
+ */
+int benchCapture(unsigned runs)
+{
+	Display *dsp = XOpenDisplay(nullptr);
+
+	if (!dsp)
+	{
+		printf("capture: no X display, skipped\n");
+		return 0;
+	}
+
+	X11 x11;
+	x11.setPerOutput(false);
+	x11.setCaptureMode(X11::FULL);
+
+	printf("capture: %u*%u\n", x11.getWidth(), x11.getHeight());
+
+	uint64_t sink = 0;
+
+	// As captures were done before MIT-SHM: a new image every frame, copied out and freed
+	const Window root = DefaultRootWindow(dsp);
+	const unsigned w  = x11.getWidth();
+	const unsigned h  = x11.getHeight();
+
+	std::vector<uint8_t> buf(size_t(w) * h * 4);
+
+	const auto original = [&]
+	{
+		XImage *img = XGetImage(dsp, root, 0, 0, w, h, AllPlanes, ZPixmap);
+
+		if (!img) return;
+
+		memcpy(buf.data(), img->data, std::min(buf.size(), size_t(img->bytes_per_line) * h));
+		XDestroyImage(img);
+
+		uint64_t r = 0, g = 0, b = 0;
+		sumBGRX(buf.data(), w, h, size_t(w) * 4, r, g, b);
+
+		sink += r + g + b;
+	};
+
+	const auto frame = [&]
+	{
+		const Frame f = x11.getX11Snapshot(0);
+
+		uint64_t r = 0, g = 0, b = 0;
+
+		if (f.data && f.format == BGRX32) sumBGRX(f.data, f.w, f.h, f.stride, r, g, b);
+
+		sink += r + g + b;
+	};
+
+	const double before = timeRuns("capture: XGetImage + copy", runs, original);
+	const double shm    = timeRuns("capture: MIT-SHM", runs, frame);
+
+	x11.setShm(false);
+
+	const double xgetimage = timeRuns("capture: XGetImage in place", runs, frame);
+
+	printf("capture: MIT-SHM is %.2fx the speed of the original path, %.2fx of XGetImage in place\n", before / shm, xgetimage / shm);
+
+	// Keeps the timed work from being optimized out
+	printf("capture: checksum %llu\n", (unsigned long long)(sink & 0xffff));
+
+	XCloseDisplay(dsp);
+
+	return 0;
+}
+
+#else
+
+int benchCapture(unsigned)
+{
+	printf("capture: X11 only, skipped\n");
+	return 0;
+}
+
+#endif
@@ -0,0 +1,60 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "bench.h"
+#include "tilegrid.h"
+#include "reduce.h"
+#include <random>
+
+/**
+ * Cost of reading a whole random 4K BGRX frame with each brightness metric, on one thread.
+ * The plain channel sums are the baseline the metrics are compared against.
+ */
+int benchMetrics(unsigned runs)
+{
+	constexpr uint32_t w = 3840, h = 2160, stride = w * 4;
+
+	std::vector<uint8_t> buf(size_t(stride) * h);
+
+	std::mt19937 rng(1);
+
+	for (auto &v : buf) v = uint8_t(rng());
+
+	const std::vector<Rect> full { Rect{0, 0, w, h} };
+	const Frame frame { buf.data(), w, h, stride, BGRX32, &full };
+
+	uint64_t sink = 0;
+
+	const double base = timeRuns("metrics: channel sums", runs, [&]
+	{
+		uint64_t r = 0, g = 0, b = 0;
+		sumBGRX(buf.data(), w, h, stride, r, g, b);
+		sink += r + g + b;
+	});
+
+	const struct { const char *label; TileGrid::Metric metric; } metrics[] =
+	{
+		{ "metrics: mean",      TileGrid::MEAN },
+		{ "metrics: median",    TileGrid::MEDIAN },
+		{ "metrics: p90",       TileGrid::P90 },
+		{ "metrics: glare",     TileGrid::GLARE },
+		{ "metrics: lightness", TileGrid::LIGHTNESS },
+	};
+
+	for (const auto &m : metrics)
+	{
+		TileGrid grid;
+		grid.setMetric(m.metric, 230);
+
+		const double ms = timeRuns(m.label, runs, [&] { sink += uint64_t(grid.update(frame)); });
+
+		printf("%-32s %.1fx the channel sums\n", "", ms / base);
+	}
+
+	// Keeps the timed work from being optimized out
+	printf("metrics: checksum %llu\n", (unsigned long long)(sink & 0xffff));
+
+	return 0;
+}
@@ -0,0 +1,23 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "bench.h"
+#include <cstdlib>
+#include <cstring>
+
+int main(int argc, char **argv)
+{
+	const char *name    = argc > 1 ? argv[1] : "all";
+	const unsigned runs = argc > 2 ? unsigned(atoi(argv[2])) : 50;
+
+	const bool all = !strcmp(name, "all");
+
+	int rc = 0;
+
+	if (all || !strcmp(name, "capture")) rc |= benchCapture(runs);
+	if (all || !strcmp(name, "metrics")) rc |= benchMetrics(runs);
+
+	return rc;
+}
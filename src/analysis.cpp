@@ -0,0 +1,152 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "analysis.h"
+#include "defs.h"
+#include <chrono>
+
+int AnalysisStage::process(const Frame &frame, int input)
+{
+	begin(frame.w, frame.h, frame.format, *frame.damage);
+	rows(frame, 0);
+
+	return finish(input);
+}
+
+void TileStage::configure(const AnalysisSettings &s)
+{
+	grid.setPool(s.pool);
+	grid.setMetric(s.metric, s.glare_threshold);
+	grid.setWeighting(s.weighting);
+	grid.setPointer(s.pointer_fx, s.pointer_fy);
+	grid.setFingerprint(s.fingerprint);
+}
+
+void TileStage::begin(uint32_t w, uint32_t h, PixelFormat fmt, const std::vector<Rect> &damage)
+{
+	grid.markDamage(w, h, fmt, damage);
+}
+
+void TileStage::rows(const Frame &strip, uint32_t y)
+{
+	grid.sumRows(strip, y);
+}
+
+int TileStage::finish(int)
+{
+	LOGV << "tiles: " << grid.tiles_read << " read, " << grid.tiles_reused << " unchanged";
+
+	// The histogram metrics all come from the same data
+	if (TileGrid::usesHist(grid.metric))
+	{
+		LOGV << "tiles: median " << grid.percentile(50) << ", p90 " << grid.percentile(90) << ", glare " << grid.glareFraction();
+	}
+
+	return grid.brightness();
+}
+
+void SampleStage::configure(const AnalysisSettings &s)
+{
+	// Listed in the chain with sample_error at 0, it still needs a bound
+	max_error = s.sample_error > 0 ? s.sample_error : 2;
+
+	exact.setPool(s.pool);
+}
+
+int SampleStage::process(const Frame &frame, int)
+{
+	const int br = sampler.estimate(frame, max_error);
+
+	LOGV << "sample: " << sampler.samples << " samples, +-" << sampler.error;
+
+	if (sampler.error <= max_error) return br;
+
+	LOGD << "sample: bound of +-" << max_error << " not reached after " << sampler.samples << " samples (+-" << sampler.error << "). Reducing the frame exactly";
+
+	// The grid isn't kept up to date between fallbacks, so the whole frame is read
+	full.assign(1, Rect{0, 0, frame.w, frame.h});
+
+	Frame whole = frame;
+	whole.damage = &full;
+
+	return exact.update(whole);
+}
+
+void AnalysisChain::build(const std::vector<std::string> &names)
+{
+	stages.clear();
+
+	for (const auto &name : names)
+	{
+		if (name == "tiles")       stages.emplace_back(new TileStage);
+		else if (name == "sample") stages.emplace_back(new SampleStage);
+		else LOGW << "Unknown analysis stage: " << name;
+	}
+
+	if (stages.empty()) stages.emplace_back(new TileStage);
+}
+
+bool AnalysisChain::empty() const
+{
+	return stages.empty();
+}
+
+void AnalysisChain::configure(const AnalysisSettings &s)
+{
+	for (auto &stage : stages) stage->configure(s);
+}
+
+bool AnalysisChain::streams() const
+{
+	for (const auto &stage : stages)
+	{
+		if (!stage->streams()) return false;
+	}
+
+	return true;
+}
+
+void AnalysisChain::begin(uint32_t w, uint32_t h, PixelFormat fmt, const std::vector<Rect> &damage)
+{
+	for (auto &stage : stages) stage->begin(w, h, fmt, damage);
+}
+
+void AnalysisChain::rows(const Frame &strip, uint32_t y)
+{
+	for (auto &stage : stages) stage->rows(strip, y);
+}
+
+int AnalysisChain::finish()
+{
+	int metric = -1;
+
+	for (auto &stage : stages)
+	{
+		metric = stage->finish(metric);
+
+		LOGV << stage->name() << ": " << metric;
+	}
+
+	return metric;
+}
+
+// Each stage is timed on the same frame, so estimators can be compared side by side
+int AnalysisChain::process(const Frame &frame)
+{
+	using namespace std::chrono;
+
+	int metric = -1;
+
+	for (auto &stage : stages)
+	{
+		const auto start = steady_clock::now();
+
+		metric = stage->process(frame, metric);
+
+		LOGV << stage->name() << ": " << metric << " in " << duration_cast<microseconds>(steady_clock::now() - start).count() << " us";
+	}
+
+	return metric;
+}
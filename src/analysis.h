@@ -0,0 +1,108 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "utils.h"
+#include "tilegrid.h"
+#include "sampler.h"
+
+class WorkerPool;
+
+// Per-frame settings handed to every stage. Stages only read what concerns them
+struct AnalysisSettings
+{
+	TileGrid::Metric    metric    = TileGrid::MEAN;
+	TileGrid::Weighting weighting = TileGrid::UNIFORM;
+
+	int    glare_threshold = 230;
+	double pointer_fx = 0.5, pointer_fy = 0.5;
+	bool   fingerprint  = false;
+	double sample_error = 0;
+
+	WorkerPool *pool = nullptr;
+};
+
+/**
+ * Turns a captured frame into a brightness metric (0-255).
+ * Stages that can read a frame one strip at a time override begin/rows/finish,
+ * the others only process(). Each stage also gets the metric of the previous one.
+ */
+class AnalysisStage
+{
+	public:
+	virtual ~AnalysisStage() = default;
+
+	virtual const char* name() const = 0;
+	virtual void configure(const AnalysisSettings &) {}
+
+	virtual bool streams() const { return false; }
+	virtual void begin(uint32_t, uint32_t, PixelFormat, const std::vector<Rect> &) {}
+	virtual void rows(const Frame &, uint32_t) {}
+	virtual int finish(int input) { return input; }
+
+	virtual int process(const Frame &frame, int input);
+};
+
+// Exact reduction over the tile grid, updated from damage
+class TileStage : public AnalysisStage
+{
+	TileGrid grid;
+
+	public:
+	const char* name() const override { return "tiles"; }
+	void configure(const AnalysisSettings &s) override;
+
+	bool streams() const override { return true; }
+	void begin(uint32_t w, uint32_t h, PixelFormat fmt, const std::vector<Rect> &damage) override;
+	void rows(const Frame &strip, uint32_t y) override;
+	int finish(int input) override;
+};
+
+// Estimate from a sparse sample of the frame, within a confidence bound
+class SampleStage : public AnalysisStage
+{
+	BrightnessSampler sampler;
+	double max_error = 2;
+
+	// Exact mean, for frames the sample pattern runs out on before reaching the bound
+	TileGrid exact;
+	std::vector<Rect> full;
+
+	public:
+	const char* name() const override { return "sample"; }
+	void configure(const AnalysisSettings &s) override;
+
+	int process(const Frame &frame, int input) override;
+};
+
+/**
+ * Runs every stage on the same frame, in order. The last stage decides the result,
+ * and the others can be compared against it in the verbose log.
+ */
+class AnalysisChain
+{
+	std::vector<std::unique_ptr<AnalysisStage>> stages;
+
+	public:
+	// Builds the chain from stage names. Unknown names are skipped, and an empty chain gets the tile stage
+	void build(const std::vector<std::string> &names);
+	bool empty() const;
+
+	void configure(const AnalysisSettings &s);
+
+	bool streams() const;
+	void begin(uint32_t w, uint32_t h, PixelFormat fmt, const std::vector<Rect> &damage);
+	void rows(const Frame &strip, uint32_t y);
+	int finish();
+
+	int process(const Frame &frame);
+};
+
+#endif // ANALYSIS_H
@@ -0,0 +1,27 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "brfilter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+int BrightnessFilter::update(int measured, double dt_ms, double tau_ms)
+{
+	// The first measurement is taken as is, so startup isn't slowed down
+	if (!primed || tau_ms <= 0)
+	{
+		value  = measured;
+		primed = true;
+	}
+	else value += (1 - std::exp(-dt_ms / tau_ms)) * (measured - value);
+
+	return int(std::lround(value));
+}
+
+bool needsTransition(int filtered, int measured, int last_sent, int threshold)
+{
+	return std::abs(filtered - last_sent) > threshold && std::abs(measured - filtered) <= std::max(threshold / 2, 1);
+}
@@ -0,0 +1,30 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#ifndef BRFILTER_H
+#define BRFILTER_H
+
+/**
+ * Exponential moving average of the measured brightness, weighted by the time between updates.
+ * Brief changes (video, scrolling) are smoothed out, while lasting ones still come through.
+ */
+class BrightnessFilter
+{
+	double value = 0;
+	bool primed  = false;
+
+	public:
+	// tau_ms is the time constant. 0 passes measurements through unchanged
+	int update(int measured, double dt_ms, double tau_ms);
+};
+
+/**
+ * Whether a filtered brightness calls for a transition: it has to be more than threshold away from the last value sent,
+ * and within half of it of the measurement. The filter approaches a step gradually, so the second condition
+ * waits for it to get close, and a step gives one transition instead of one per threshold it crosses.
+ */
+bool needsTransition(int filtered, int measured, int last_sent, int threshold);
+
+#endif // BRFILTER_H
@@ -27,6 +27,18 @@ json setDefault()
 		{"temp_speed", 30.0 },
 		{"threshold", 36 },
 		{"polling_rate", 100 },
+		{"capture_mode", "full" },
+		{"x11_backend", "xlib" },
+		{"per_output", true },
+		{"capture_window", false },
+		{"reduce_threads", 2 },
+		{"analysis", { "tiles" } },
+		{"sample_error", 0.0 },
+		{"brightness_metric", "mean" },
+		{"glare_threshold", 230 },
+		{"weighting", "uniform" },
+		{"br_time_constant", 1000 },
+		{"gamma_vsync_divisor", 0 },
 		{"temp_step", 0 },
 		{"temp_high", max_temp_kelvin },
 		{"temp_low", 3400 },
@@ -0,0 +1,165 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "gammacompositor.h"
+
+GammaCompositor::GammaCompositor(Apply apply, int brightness, int temp)
+	: apply(std::move(apply)), brightness(brightness), temp(temp)
+{
+	thr = std::thread(&GammaCompositor::run, this);
+}
+
+void GammaCompositor::setBrightness(int step)
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+
+		brightness = step;
+		pending    = true;
+		++posted;
+	}
+
+	cv.notify_one();
+}
+
+void GammaCompositor::setTemp(int step)
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+
+		temp    = step;
+		pending = true;
+		++posted;
+	}
+
+	cv.notify_one();
+}
+
+void GammaCompositor::setOutputSteps(OutputSteps steps)
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+
+		if (steps == outputs) return;
+
+		outputs = std::move(steps);
+		pending = true;
+		++posted;
+	}
+
+	cv.notify_one();
+}
+
+void GammaCompositor::invalidate()
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+
+		pending = true;
+		++posted;
+	}
+
+	cv.notify_one();
+}
+
+GammaCompositor::OutputSteps GammaCompositor::getOutputSteps()
+{
+	std::lock_guard<std::mutex> lock(m);
+
+	return outputs;
+}
+
+void GammaCompositor::setRefreshRate(double hz)
+{
+	if (hz <= 0) return;
+
+	std::lock_guard<std::mutex> lock(m);
+
+	frame = std::chrono::microseconds(int64_t(1e6 / hz));
+
+	LOGD << "Gamma updates limited to " << hz << " Hz";
+}
+
+void GammaCompositor::setFrameClock(FrameClock clock)
+{
+	std::lock_guard<std::mutex> lock(m);
+
+	frame_clock = std::move(clock);
+}
+
+void GammaCompositor::run()
+{
+	using namespace std::chrono;
+
+	// Bounds each wait on the frame clock, so stop() isn't held up by a display that stopped ticking
+	constexpr int clock_timeout_ms = 250;
+
+	auto next_frame = steady_clock::now();
+
+	while (true)
+	{
+		FrameClock clock;
+
+		{
+			std::unique_lock<std::mutex> lock(m);
+
+			cv.wait(lock, [&] { return pending || quit; });
+
+			if (quit) break;
+
+			clock = frame_clock;
+		}
+
+		// Everything posted until the next frame is merged into one ramp
+		if (!clock || !clock(clock_timeout_ms))
+		{
+			std::unique_lock<std::mutex> lock(m);
+
+			cv.wait_until(lock, next_frame, [&] { return quit; });
+		}
+
+		int br, tmp;
+		OutputSteps outs;
+
+		{
+			std::lock_guard<std::mutex> lock(m);
+
+			if (quit) break;
+
+			br      = brightness;
+			tmp     = temp;
+			outs    = outputs;
+			pending = false;
+		}
+
+		apply(br, tmp, outs);
+
+		std::lock_guard<std::mutex> lock(m);
+
+		++applied;
+		next_frame = steady_clock::now() + frame;
+	}
+}
+
+void GammaCompositor::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+
+		if (quit) return;
+
+		quit = true;
+	}
+
+	cv.notify_one();
+	thr.join();
+
+	LOGD << "Gamma updates posted: " << posted << ", applied: " << applied;
+}
+
+GammaCompositor::~GammaCompositor()
+{
+	stop();
+}
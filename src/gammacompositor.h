@@ -0,0 +1,77 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#ifndef GAMMACOMPOSITOR_H
+#define GAMMACOMPOSITOR_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "defs.h"
+
+/**
+ * Owns the gamma state, and is the only thread that writes ramps.
+ * Brightness and temperature are posted to a mailbox where the latest values win,
+ * and at most one ramp combining both is applied per display frame.
+ */
+class GammaCompositor
+{
+	public:
+	// Brightness steps of single outputs, by id (the CRTC on X11). Outputs not listed follow the shared step
+	using OutputSteps = std::vector<std::pair<uint64_t, int>>;
+
+	using Apply = std::function<void(int brightness, int temp, const OutputSteps &outputs)>;
+
+	// Blocks until the next frame boundary. Returns false if it timed out or can't be used
+	using FrameClock = std::function<bool(int timeout_ms)>;
+
+	private:
+	Apply apply;
+	FrameClock frame_clock;
+
+	std::thread thr;
+	std::mutex m;
+	convar cv;
+
+	int  brightness;
+	int  temp;
+	OutputSteps outputs;
+	bool pending = true;
+	bool quit    = false;
+
+	std::chrono::microseconds frame {16667};
+
+	uint64_t posted  = 0;
+	uint64_t applied = 0;
+
+	void run();
+
+	public:
+	// The initial state is applied right away
+	GammaCompositor(Apply apply, int brightness, int temp);
+
+	void setBrightness(int step);
+	void setTemp(int step);
+	void setOutputSteps(OutputSteps steps);
+
+	// Applies the current state again, e.g. after the outputs changed and their ramps were reset
+	void invalidate();
+	OutputSteps getOutputSteps();
+	void setRefreshRate(double hz);
+
+	// Paces updates off the display (e.g. vblank events) instead of a timer
+	void setFrameClock(FrameClock clock);
+
+	// Drops pending updates and joins the thread. Nothing is written afterwards
+	void stop();
+
+	~GammaCompositor();
+};
+
+#endif // GAMMACOMPOSITOR_H
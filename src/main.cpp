@@ -16,6 +16,11 @@
 
 #include "cfg.h"
 #include "utils.h"
+#include "tilegrid.h"
+#include "workerpool.h"
+#include "analysis.h"
+#include "brfilter.h"
+#include "gammacompositor.h"
 
 #include <thread>
 #include <mutex>
@@ -216,6 +221,9 @@ struct Args
 
 	int img_br = 0;
 	bool br_needs_change = false;
+
+	// Filtered brightness of each output that is a CRTC of its own, by CRTC
+	std::vector<std::pair<uint64_t, int>> out_br;
 };
 
 void adjustBrightness(Args &args, MainWindow &w)
@@ -226,6 +234,7 @@ void adjustBrightness(Args &args, MainWindow &w)
 	while(true)
 	{
 		int img_br;
+		std::vector<std::pair<uint64_t, int>> out_br;
 
 		{
 			std::unique_lock<std::mutex> lock(args.br_mtx);
@@ -240,12 +249,31 @@ void adjustBrightness(Args &args, MainWindow &w)
 			args.br_needs_change = false;
 
 			img_br = args.img_br;
+			out_br = args.out_br;
+		}
+
+		const int target = calcBrightnessTarget(img_br, cfg["offset"], cfg["min_br"], cfg["max_br"]);
+
+		// Outputs dimmer than the brightest one get a brighter step of their own.
+		// Each one moves from where it is now, or from the shared step if it had none
+		const GammaCompositor::OutputSteps cur_step = w.gamma ? w.gamma->getOutputSteps() : GammaCompositor::OutputSteps();
+
+		GammaCompositor::OutputSteps out_start, out_end;
+
+		for (const auto &o : out_br)
+		{
+			const auto cur = std::find_if(cur_step.begin(), cur_step.end(), [&o] (const std::pair<uint64_t, int> &p) { return p.first == o.first; });
+
+			out_start.emplace_back(o.first, cur != cur_step.end() ? cur->second : brt_step);
+			out_end.emplace_back(o.first, calcBrightnessTarget(o.second, cfg["offset"], cfg["min_br"], cfg["max_br"]));
 		}
 
-		int target = brt_slider_steps - int(remap(img_br, 0, 255, 0, brt_slider_steps)) + cfg["offset"].get<int>();
-		target = clamp(target, cfg["min_br"].get<int>(), cfg["max_br"].get<int>());
+		GammaCompositor::OutputSteps out_step = out_start;
 
-		if (target == brt_step)
+		// Outputs that went away, or stopped being captured separately, follow the shared step again
+		if (w.gamma) w.gamma->setOutputSteps(out_step);
+
+		if (target == brt_step && out_step == out_end)
 		{
 			LOGD << "Brt already at target (" << target << ')';
 			continue;
@@ -264,10 +292,20 @@ void adjustBrightness(Args &args, MainWindow &w)
 
 		LOGD << "(" << start << "->" << end << ')';
 
-		while (brt_step != target && !args.br_needs_change && cfg["auto_br"] && !w.quit)
+		while ((brt_step != target || out_step != out_end) && !args.br_needs_change && cfg["auto_br"] && !w.quit)
 		{
 			time += time_incr;
 
+			for (size_t i = 0; i < out_step.size(); ++i)
+			{
+				const int s = out_start[i].second;
+
+				out_step[i].second = std::round(easeOutExpo(time, s, out_end[i].second - s, duration));
+			}
+
+			// Posted first, so the compositor can apply it with the shared step in one ramp update
+			if (w.gamma) w.gamma->setOutputSteps(out_step);
+
 			brt_step = std::round(easeOutExpo(time, start, distance, duration));
 
 			w.setBrtSlider(brt_step);
@@ -275,6 +313,9 @@ void adjustBrightness(Args &args, MainWindow &w)
 			sleep_for(milliseconds(1000 / FPS));
 		}
 
+		// Auto brightness may have been turned off midway. recordScreen clears the steps too, but may have done it first
+		if (!cfg["auto_br"] && w.gamma) w.gamma->setOutputSteps({});
+
 		LOGD << "(" << start << "->" << end << ") done";
 	}
 }
@@ -302,24 +343,94 @@ void recordScreen(Args &args, convar &ss_cv, MainWindow &w)
 		LOGE << "DXGI initialization failed. Using GDI instead";
 		w.setPollingRange(1000, 5000);
 	}
+
+	LOGD << "Buffer size: " << len;
 #else
-	const uint64_t screen_res = args.x11->getWidth() * args.x11->getHeight();
-	const uint64_t len = screen_res * 4;
+	// The capture geometry follows XRandR changes, so nothing is sized here. Gamma is set by the compositor
 
-	args.x11->setXF86Gamma(brt_step, cfg["temp_step"]);
+	static_assert(X11::strip_h % TileGrid::tile_sz == 0, "Strips must start on tile boundaries");
 #endif
 
-	LOGD << "Buffer size: " << len;
-
 	// Buffer to store screen pixels
 	std::vector<uint8_t> buf;
 
+	// Dirty tiles are summed on a few persistent threads. Kept small, as this runs in the background
+	WorkerPool pool(unsigned(clamp(cfg["reduce_threads"], 1, std::max(int(std::thread::hardware_concurrency()), 1))));
+
+	// One analysis chain per output, rebuilt when the configured stages change
+	std::vector<AnalysisChain> chains;
+	std::string chain_cfg;
+
+	// Last measured brightness of each output, its filter and its CRTC (0 if it doesn't have one of its own)
+	std::vector<int> out_br;
+	std::vector<BrightnessFilter> filters;
+	std::vector<uint64_t> out_crtc;
+
+	// Filtered brightness of each output, and its value when the last transition was sent
+	std::vector<int> out_filtered;
+	std::vector<int> out_sent;
+
+	auto last_filter = steady_clock::now();
+
 	std::thread br_thr(adjustBrightness, std::ref(args), std::ref(w));
 
-	const auto getSnapshot = [&] (std::vector<uint8_t> &buf)
+	// Settings shared by the stages of every output
+	const auto analysisSettings = [&]
+	{
+		AnalysisSettings s;
+
+		const std::string metric = cfg["brightness_metric"];
+
+		if (metric == "median")         s.metric = TileGrid::MEDIAN;
+		else if (metric == "p90")       s.metric = TileGrid::P90;
+		else if (metric == "glare")     s.metric = TileGrid::GLARE;
+		else if (metric == "lightness") s.metric = TileGrid::LIGHTNESS;
+
+		const std::string weighting = cfg["weighting"];
+
+		if (weighting == "center")       s.weighting = TileGrid::CENTER;
+		else if (weighting == "pointer") s.weighting = TileGrid::POINTER;
+
+		s.glare_threshold = cfg["glare_threshold"];
+		s.sample_error    = cfg["sample_error"];
+		s.pool            = &pool;
+
+		return s;
+	};
+
+	const auto prepareChains = [&] (size_t outputs, bool exact)
+	{
+		std::vector<std::string> names = cfg["analysis"];
+
+		// Above 0, sample_error has brightness estimated from a subset of pixels instead of the chain,
+		// unless the chain already lists the sample stage
+		const bool sampled = std::find(names.begin(), names.end(), "sample") != names.end();
+
+		if (!exact && !sampled && double(cfg["sample_error"]) > 0) names = { "sample" };
+
+		const std::string stages = json(names).dump();
+
+		if (stages != chain_cfg)
+		{
+			chains.clear();
+			chain_cfg = stages;
+		}
+
+		chains.resize(outputs);
+
+		for (auto &chain : chains)
+		{
+			if (chain.empty()) chain.build(names);
+		}
+	};
+
+	// Captures the screen and measures the brightness of each output
+	const auto getBrightness = [&]
 	{
 		LOGV << "Taking screenshot";
 
+		AnalysisSettings settings = analysisSettings();
+
 #ifdef _WIN32
 		if (useDXGI)
 		{
@@ -330,21 +441,139 @@ void recordScreen(Args &args, convar &ss_cv, MainWindow &w)
 			getGDISnapshot(buf);
 			sleep_for(milliseconds(cfg["polling_rate"]));
 		}
+
+		prepareChains(1, false);
+
+		// Captures carry no damage information, so every tile is hashed instead
+		const std::vector<Rect> full { { 0, 0, uint32_t(width), uint32_t(height) } };
+
+		settings.fingerprint = true;
+
+		if (settings.weighting == TileGrid::POINTER)
+		{
+			POINT p;
+
+			if (GetCursorPos(&p))
+			{
+				settings.pointer_fx = (p.x - GetSystemMetrics(SM_XVIRTUALSCREEN)) / double(width);
+				settings.pointer_fy = (p.y - GetSystemMetrics(SM_YVIRTUALSCREEN)) / double(height);
+			}
+			else settings.weighting = TileGrid::CENTER;
+		}
+
+		chains[0].configure(settings);
+
+		out_br.assign(1, chains[0].process({ buf.data(), uint32_t(width), uint32_t(height), uint32_t(width * 4), BGRX32, &full }));
+		out_crtc.assign(1, 0);
 #else
-		args.x11->getX11Snapshot(buf);
+		const auto start = steady_clock::now();
+
+		const size_t outputs = args.x11->getOutputCount();
+
+		// Strips are always reduced exactly
+		prepareChains(outputs, args.x11->capture_mode == X11::STRIPS);
+		out_br.resize(outputs);
+		out_crtc.resize(outputs);
+
+		int pointer_x = 0, pointer_y = 0;
+
+		if (settings.weighting == TileGrid::POINTER && !args.x11->getPointer(pointer_x, pointer_y))
+		{
+			settings.weighting = TileGrid::CENTER;
+		}
+
+		// Unchanged tiles are found by hashing instead
+		settings.fingerprint = !args.x11->hasDamage();
+
+		// On X11, only the tiles touched by damage get summed again
+		for (size_t i = 0; i < outputs; ++i)
+		{
+			AnalysisChain &chain = chains[i];
+
+			const Rect rect = args.x11->getOutputRect(i);
+
+			// Off this output, the nearest edge gets the most weight
+			settings.pointer_fx = (pointer_x - int(rect.x)) / double(rect.w);
+			settings.pointer_fy = (pointer_y - int(rect.y)) / double(rect.h);
+
+			chain.configure(settings);
+
+			if (args.x11->capture_mode == X11::STRIPS && chain.streams())
+			{
+				chain.begin(rect.w, rect.h, args.x11->getPixelFormat(), args.x11->getDamage(i));
+
+				args.x11->getX11Strips(i, [&] (const Frame &strip, uint32_t y)
+				{
+					chain.rows(strip, y);
+				});
+
+				out_br[i] = chain.finish();
+			}
+			else
+			{
+				const Frame frame = args.x11->getX11Snapshot(i);
+
+				// A failed capture keeps the last measurement. The outputs are planned again on the next wait
+				if (frame.data) out_br[i] = chain.process(frame);
+			}
+
+			out_crtc[i] = args.x11->getOutputCrtc(i);
+
+			LOGV << "Output " << i << " brightness: " << out_br[i];
+		}
+
+		LOGV << "Snapshot processed in " << duration_cast<microseconds>(steady_clock::now() - start).count() << " us";
 
 		sleep_for(milliseconds(cfg["polling_rate"]));
 #endif
 	};
 
+	// Smooths each output's brightness over time. Runs on every iteration, so it keeps
+	// converging while the screen doesn't change
+	const auto filterBrightness = [&]
+	{
+		const auto now  = steady_clock::now();
+		const double dt = duration<double, std::milli>(now - last_filter).count();
+
+		last_filter = now;
+
+		const double tau = cfg["br_time_constant"];
+
+		filters.resize(out_br.size());
+		out_filtered.resize(out_br.size());
+		out_sent.resize(out_br.size());
+
+		// The brightest output sets the shared step. Outputs with a CRTC of their own are dimmed separately
+		int img_br = 0;
+
+		for (size_t i = 0; i < out_br.size(); ++i)
+		{
+			out_filtered[i] = filters[i].update(out_br[i], dt, tau);
+
+			img_br = std::max(img_br, out_filtered[i]);
+		}
+
+		return img_br;
+	};
+
+	// Returns false if nothing on screen has changed since the last snapshot
+	const auto screenChanged = [&]
+	{
+#ifdef _WIN32
+		return true;
+#else
+		return args.x11->waitForDamage(cfg["polling_rate"]);
+#endif
+	};
+
 	std::mutex m;
 
-	int img_delta = 0;
+	// Filtered brightness when the last transition was sent
+	int sent_img_br = 0;
 
 	bool force = false;
 
 	int
-	prev_img_br	= 0,
 	prev_min	= 0,
 	prev_max	= 0,
 	prev_offset	= 0;
@@ -367,7 +596,21 @@ void recordScreen(Args &args, convar &ss_cv, MainWindow &w)
 
 		if(cfg["auto_br"])
 		{
+#ifdef _WIN32
 			buf.resize(len);
+#else
+			args.x11->setPerOutput(cfg["per_output"]);
+			args.x11->setCaptureWindow(cfg["capture_window"]);
+
+			const std::string backend = cfg["x11_backend"];
+			args.x11->setBackend(backend == "xcb" ? X11::XCB : X11::XLIB);
+
+			const std::string mode = cfg["capture_mode"];
+
+			if (mode == "thumbnail")   args.x11->setCaptureMode(X11::THUMBNAIL);
+			else if (mode == "strips") args.x11->setCaptureMode(X11::STRIPS);
+			else                       args.x11->setCaptureMode(X11::FULL);
+#endif
 			force = true;
 		}
 		else
@@ -379,21 +622,40 @@ void recordScreen(Args &args, convar &ss_cv, MainWindow &w)
 
 		while(cfg["auto_br"] && !w.quit)
 		{
-			getSnapshot(buf);
+			if (screenChanged()) getBrightness();
+
+			const int img_br    = filterBrightness();
+			const int threshold = cfg["threshold"];
 
-			const int img_br = calcBrightness(buf);
-			img_delta += abs(prev_img_br - img_br);
+			// Measured (unfiltered) brightness of the brightest output, to tell when the filter caught up
+			const int img_measured = out_br.empty() ? 0 : *std::max_element(out_br.begin(), out_br.end());
+
+			// A dimmer output changing on its own moves its step too
+			bool out_moved = false;
+
+			for (size_t i = 0; i < out_crtc.size() && i < out_filtered.size(); ++i)
+			{
+				out_moved |= out_crtc[i] && needsTransition(out_filtered[i], out_br[i], out_sent[i], threshold);
+			}
 
-			if (img_delta > cfg["threshold"] || force)
+			if (needsTransition(img_br, img_measured, sent_img_br, threshold) || out_moved || force)
 			{
-				img_delta = 0;
-				force = false;
+				sent_img_br = img_br;
+				out_sent    = out_filtered;
+				force       = false;
 
 				{
 					const std::lock_guard<std::mutex> lock (args.br_mtx);
 
 					args.img_br = img_br;
 					args.br_needs_change = true;
+
+					args.out_br.clear();
+
+					for (size_t i = 0; i < out_crtc.size() && i < out_filtered.size(); ++i)
+					{
+						if (out_crtc[i]) args.out_br.emplace_back(out_crtc[i], out_filtered[i]);
+					}
 				}
 
 				args.br_cv.notify_one();
@@ -404,12 +666,19 @@ void recordScreen(Args &args, convar &ss_cv, MainWindow &w)
 				force = true;
 			}
 
-			prev_img_br = img_br;
 			prev_min    = cfg["min_br"];
 			prev_max    = cfg["max_br"];
 			prev_offset = cfg["offset"];
 		}
 
+		// Manual brightness is the same on every output
+		{
+			const std::lock_guard<std::mutex> lock (args.br_mtx);
+			args.out_br.clear();
+		}
+
+		if (w.gamma) w.gamma->setOutputSteps({});
+
 		buf.clear();
 		buf.shrink_to_fit();
 	}
@@ -492,17 +761,41 @@ int main(int argc, char **argv)
 
 #ifdef _WIN32
 	MainWindow wnd(nullptr, &ss_cv, &temp_cv);
+
+	// Outputs can't be told apart, so they all share one ramp
+	GammaCompositor gamma([] (int br, int temp, const GammaCompositor::OutputSteps &) { setGDIGamma(br, temp); }, brt_step, cfg["temp_step"]);
+
+	HDC dc = GetDC(nullptr);
+	gamma.setRefreshRate(GetDeviceCaps(dc, VREFRESH));
+	ReleaseDC(nullptr, dc);
 #else
 	X11 x11;
 
 	MainWindow wnd(&x11, &ss_cv, &temp_cv);
 
+	GammaCompositor gamma([&x11] (int br, int temp, const GammaCompositor::OutputSteps &outputs) { x11.setXF86Gamma(br, temp, outputs); }, brt_step, cfg["temp_step"]);
+	gamma.setRefreshRate(x11.getRefreshRate());
+
+	// Layout changes only reset the CRTC list. The ramps are written again from here
+	x11.setGammaReset([&gamma] { gamma.invalidate(); });
+
+	// Every n-th vblank, through Present. 0 keeps the timer
+	const int vsync_divisor = cfg["gamma_vsync_divisor"];
+
+	if (vsync_divisor > 0 && x11.initPresent(unsigned(vsync_divisor)))
+	{
+		gamma.setFrameClock([&x11] (int timeout_ms) { return x11.waitForVblank(timeout_ms); });
+	}
+
 	thr_args.x11 = &x11;
 	p_quit = &wnd.quit;
 	p_ss_cv = &ss_cv;
 	p_temp_cv = &temp_cv;
 #endif
 
+	// Sliders and animations post their steps here, instead of each writing ramps
+	wnd.gamma = &gamma;
+
 	std::thread temp_thr(adjustTemperature, std::ref(temp_cv), std::ref(wnd));
 	std::thread ss_thr(recordScreen, std::ref(thr_args), std::ref(ss_cv), std::ref(wnd));
 
@@ -518,6 +811,9 @@ int main(int argc, char **argv)
 
 	LOGV << "recordScreen joined";
 
+	// No more ramps are written behind the restored one
+	gamma.stop();
+
 	if(os_is_windows) {
 		setGDIGamma(brt_slider_steps, 0);
 	}
@@ -259,12 +259,7 @@ void MainWindow::on_tempSlider_valueChanged(int val)
 
 	if(this->quit) return;
 
-	if(os_is_windows) {
-		setGDIGamma(brt_step, val);
-	}
-#ifndef _WIN32
-	else x11->setXF86Gamma(brt_step, val);
-#endif
+	if(gamma) gamma->setTemp(val);
 
 	double temp_kelvin = remap(temp_slider_steps - val, 0, temp_slider_steps, min_temp_kelvin, max_temp_kelvin);
 
@@ -338,12 +333,7 @@ void MainWindow::on_manBrSlider_valueChanged(int value)
 	brt_step = value;
 	cfg["brightness"] = value;
 
-	if(os_is_windows) {
-		setGDIGamma(brt_step, cfg["temp_step"]);
-	}
-#ifndef _WIN32
-	else x11->setXF86Gamma(brt_step, cfg["temp_step"]);
-#endif
+	if(gamma) gamma->setBrightness(brt_step);
 
 	updateBrLabel();
 }
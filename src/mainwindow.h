@@ -20,6 +20,7 @@
 #include <QSystemTrayIcon>
 
 #include "defs.h"
+#include "gammacompositor.h"
 
 namespace Ui {
 class MainWindow;
@@ -43,6 +44,9 @@ public:
 	bool *force_br_change	= nullptr;
 	bool *force_temp_change = nullptr;
 
+	// Set once the window is up. Slider changes before that are covered by its initial state
+	GammaCompositor *gamma	= nullptr;
+
 	bool quit		= false;
 	bool set_previous_gamma = true;
 	bool ignore_closeEvent	= true;
@@ -0,0 +1,95 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#ifndef PIXELFORMAT_H
+#define PIXELFORMAT_H
+
+#include <array>
+#include <cstdint>
+
+// Pixel layouts of captured images, all little-endian
+enum PixelFormat
+{
+	BGRX32, // 8 bits per channel in 4 bytes
+	BGR24,  // 8 bits per channel, packed in 3 bytes
+	RGB565, // 5/6/5 bits in 2 bytes
+	RGB30   // 10 bits per channel in 4 bytes (depth 30)
+};
+
+/**
+ * Channel extraction for each format, so reduction loops can be specialized at compile time.
+ * add() accumulates the raw channel values, in the 0 to *_max range.
+ */
+template <PixelFormat F> struct Pixel;
+
+template <> struct Pixel<BGRX32>
+{
+	static constexpr uint32_t size = 4;
+	static constexpr uint32_t r_max = 255, g_max = 255, b_max = 255;
+
+	static void add(const uint8_t *p, uint64_t &r, uint64_t &g, uint64_t &b)
+	{
+		r += p[2];
+		g += p[1];
+		b += p[0];
+	}
+};
+
+template <> struct Pixel<BGR24>
+{
+	static constexpr uint32_t size = 3;
+	static constexpr uint32_t r_max = 255, g_max = 255, b_max = 255;
+
+	static void add(const uint8_t *p, uint64_t &r, uint64_t &g, uint64_t &b)
+	{
+		r += p[2];
+		g += p[1];
+		b += p[0];
+	}
+};
+
+template <> struct Pixel<RGB565>
+{
+	static constexpr uint32_t size = 2;
+	static constexpr uint32_t r_max = 31, g_max = 63, b_max = 31;
+
+	static void add(const uint8_t *p, uint64_t &r, uint64_t &g, uint64_t &b)
+	{
+		const uint32_t v = uint32_t(p[0]) | uint32_t(p[1]) << 8;
+
+		r += v >> 11;
+		g += (v >> 5) & 0x3f;
+		b += v & 0x1f;
+	}
+};
+
+template <> struct Pixel<RGB30>
+{
+	static constexpr uint32_t size = 4;
+	static constexpr uint32_t r_max = 1023, g_max = 1023, b_max = 1023;
+
+	static void add(const uint8_t *p, uint64_t &r, uint64_t &g, uint64_t &b)
+	{
+		const uint32_t v = uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+
+		r += (v >> 20) & 0x3ff;
+		g += (v >> 10) & 0x3ff;
+		b += v & 0x3ff;
+	}
+};
+
+// Largest value of each channel (r, g, b)
+constexpr std::array<uint32_t, 3> channelMax(PixelFormat f)
+{
+	switch (f)
+	{
+	case BGR24:  return { Pixel<BGR24>::r_max,  Pixel<BGR24>::g_max,  Pixel<BGR24>::b_max };
+	case RGB565: return { Pixel<RGB565>::r_max, Pixel<RGB565>::g_max, Pixel<RGB565>::b_max };
+	case RGB30:  return { Pixel<RGB30>::r_max,  Pixel<RGB30>::g_max,  Pixel<RGB30>::b_max };
+	default:     return { Pixel<BGRX32>::r_max, Pixel<BGRX32>::g_max, Pixel<BGRX32>::b_max };
+	}
+}
+
+#endif // PIXELFORMAT_H
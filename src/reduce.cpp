@@ -0,0 +1,302 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "reduce.h"
+#include "srgb.h"
+#include "defs.h"
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define REDUCE_X86
+#include <immintrin.h>
+#endif
+
+void sumBGRXScalar(const uint8_t *px, uint32_t width, uint32_t rows, size_t stride, uint64_t &r, uint64_t &g, uint64_t &b)
+{
+	for (uint32_t y = 0; y < rows; ++y, px += stride)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			r += px[x * 4 + 2];
+			g += px[x * 4 + 1];
+			b += px[x * 4];
+		}
+	}
+}
+
+void sumLinearBGRXScalar(const uint8_t *px, uint32_t width, uint32_t rows, size_t stride, uint64_t &y)
+{
+	for (uint32_t row = 0; row < rows; ++row, px += stride)
+	{
+		// Two chains, so the lookups of neighbouring pixels overlap. A row can't overflow them
+		uint32_t y0 = 0, y1 = 0;
+		uint32_t x  = 0;
+
+		for (; x + 2 <= width; x += 2)
+		{
+			const uint8_t *p = px + x * 4;
+
+			y0 += linear_b[p[0]] + linear_g[p[1]] + linear_r[p[2]];
+			y1 += linear_b[p[4]] + linear_g[p[5]] + linear_r[p[6]];
+		}
+
+		if (x < width) y0 += linear_b[px[x * 4]] + linear_g[px[x * 4 + 1]] + linear_r[px[x * 4 + 2]];
+
+		y += uint64_t(y0) + y1;
+	}
+}
+
+#ifdef REDUCE_X86
+
+/*
+ * Each channel is masked out of its 32-bit pixels and summed with psadbw against zero,
+ * which adds 8 bytes at a time into 64-bit lanes. Nothing can overflow, and leftover pixels
+ * at the end of a row go through the scalar loop, so the results match it exactly.
+ */
+
+__attribute__((target("sse2")))
+static void sumBGRXSSE2(const uint8_t *px, uint32_t width, uint32_t rows, size_t stride, uint64_t &r, uint64_t &g, uint64_t &b)
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	const __m128i zero = _mm_setzero_si128();
+
+	__m128i acc_r = zero, acc_g = zero, acc_b = zero;
+
+	const uint32_t vec_w = width & ~3u;
+
+	for (uint32_t y = 0; y < rows; ++y, px += stride)
+	{
+		for (uint32_t x = 0; x < vec_w; x += 4)
+		{
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(px + x * 4));
+
+			acc_b = _mm_add_epi64(acc_b, _mm_sad_epu8(_mm_and_si128(v, mask), zero));
+			acc_g = _mm_add_epi64(acc_g, _mm_sad_epu8(_mm_and_si128(_mm_srli_epi32(v, 8), mask), zero));
+			acc_r = _mm_add_epi64(acc_r, _mm_sad_epu8(_mm_and_si128(_mm_srli_epi32(v, 16), mask), zero));
+		}
+
+		sumBGRXScalar(px + vec_w * 4, width - vec_w, 1, stride, r, g, b);
+	}
+
+	alignas(16) uint64_t lanes[2];
+
+	_mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc_r);
+	r += lanes[0] + lanes[1];
+	_mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc_g);
+	g += lanes[0] + lanes[1];
+	_mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc_b);
+	b += lanes[0] + lanes[1];
+}
+
+__attribute__((target("avx2")))
+static void sumBGRXAVX2(const uint8_t *px, uint32_t width, uint32_t rows, size_t stride, uint64_t &r, uint64_t &g, uint64_t &b)
+{
+	const __m256i mask = _mm256_set1_epi32(0xff);
+	const __m256i zero = _mm256_setzero_si256();
+
+	__m256i acc_r = zero, acc_g = zero, acc_b = zero;
+
+	const uint32_t vec_w = width & ~7u;
+
+	for (uint32_t y = 0; y < rows; ++y, px += stride)
+	{
+		for (uint32_t x = 0; x < vec_w; x += 8)
+		{
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(px + x * 4));
+
+			acc_b = _mm256_add_epi64(acc_b, _mm256_sad_epu8(_mm256_and_si256(v, mask), zero));
+			acc_g = _mm256_add_epi64(acc_g, _mm256_sad_epu8(_mm256_and_si256(_mm256_srli_epi32(v, 8), mask), zero));
+			acc_r = _mm256_add_epi64(acc_r, _mm256_sad_epu8(_mm256_and_si256(_mm256_srli_epi32(v, 16), mask), zero));
+		}
+
+		sumBGRXScalar(px + vec_w * 4, width - vec_w, 1, stride, r, g, b);
+	}
+
+	alignas(32) uint64_t lanes[4];
+
+	_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc_r);
+	r += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc_g);
+	g += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc_b);
+	b += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void sumBGRXAVX512(const uint8_t *px, uint32_t width, uint32_t rows, size_t stride, uint64_t &r, uint64_t &g, uint64_t &b)
+{
+	const __m512i mask = _mm512_set1_epi32(0xff);
+	const __m512i zero = _mm512_setzero_si512();
+
+	__m512i acc_r = zero, acc_g = zero, acc_b = zero;
+
+	const uint32_t vec_w = width & ~15u;
+
+	for (uint32_t y = 0; y < rows; ++y, px += stride)
+	{
+		for (uint32_t x = 0; x < vec_w; x += 16)
+		{
+			const __m512i v = _mm512_loadu_si512(px + x * 4);
+
+			acc_b = _mm512_add_epi64(acc_b, _mm512_sad_epu8(_mm512_and_si512(v, mask), zero));
+			acc_g = _mm512_add_epi64(acc_g, _mm512_sad_epu8(_mm512_and_si512(_mm512_srli_epi32(v, 8), mask), zero));
+			acc_r = _mm512_add_epi64(acc_r, _mm512_sad_epu8(_mm512_and_si512(_mm512_srli_epi32(v, 16), mask), zero));
+		}
+
+		sumBGRXScalar(px + vec_w * 4, width - vec_w, 1, stride, r, g, b);
+	}
+
+	r += uint64_t(_mm512_reduce_add_epi64(acc_r));
+	g += uint64_t(_mm512_reduce_add_epi64(acc_g));
+	b += uint64_t(_mm512_reduce_add_epi64(acc_b));
+}
+
+/*
+ * Each channel of 8 pixels indexes its table through one gather. Lanes are 32-bit within a row
+ * and widened to 64 bits at the end of it, and leftover pixels go through the scalar loop.
+ */
+__attribute__((target("avx2")))
+static void sumLinearBGRXAVX2(const uint8_t *px, uint32_t width, uint32_t rows, size_t stride, uint64_t &y)
+{
+	const __m256i mask = _mm256_set1_epi32(0xff);
+
+	const auto *lut_r = reinterpret_cast<const int*>(linear_r.data());
+	const auto *lut_g = reinterpret_cast<const int*>(linear_g.data());
+	const auto *lut_b = reinterpret_cast<const int*>(linear_b.data());
+
+	__m256i acc = _mm256_setzero_si256();
+
+	const uint32_t vec_w = width & ~7u;
+
+	for (uint32_t row = 0; row < rows; ++row, px += stride)
+	{
+		__m256i row_acc = _mm256_setzero_si256();
+
+		for (uint32_t x = 0; x < vec_w; x += 8)
+		{
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(px + x * 4));
+
+			const __m256i b = _mm256_i32gather_epi32(lut_b, _mm256_and_si256(v, mask), 4);
+			const __m256i g = _mm256_i32gather_epi32(lut_g, _mm256_and_si256(_mm256_srli_epi32(v, 8), mask), 4);
+			const __m256i r = _mm256_i32gather_epi32(lut_r, _mm256_and_si256(_mm256_srli_epi32(v, 16), mask), 4);
+
+			row_acc = _mm256_add_epi32(row_acc, _mm256_add_epi32(b, _mm256_add_epi32(g, r)));
+		}
+
+		acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(row_acc)));
+		acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(row_acc, 1)));
+
+		sumLinearBGRXScalar(px + vec_w * 4, width - vec_w, 1, stride, y);
+	}
+
+	alignas(32) uint64_t lanes[4];
+
+	_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+	y += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+#endif // REDUCE_X86
+
+/**
+ * Multiply-xor over 64-bit words, in four independent lanes so the multiplies overlap
+ * (and vectorize where 64-bit multiplies are available). Not cryptographic: it only has to
+ * notice changed pixels.
+ */
+uint64_t hashRows(const uint8_t *px, size_t row_bytes, uint32_t rows, size_t stride)
+{
+	constexpr uint64_t k = 0x9e3779b97f4a7c15;
+
+	uint64_t lanes[4] = { 1, 2, 3, 4 };
+
+	const size_t vec_bytes = row_bytes & ~size_t(31);
+
+	for (uint32_t y = 0; y < rows; ++y, px += stride)
+	{
+		for (size_t x = 0; x < vec_bytes; x += 32)
+		{
+			for (size_t l = 0; l < 4; ++l)
+			{
+				uint64_t word;
+				memcpy(&word, px + x + l * 8, 8);
+
+				lanes[l] = (lanes[l] ^ word) * k;
+			}
+		}
+
+		// Leftover bytes of the row
+		for (size_t x = vec_bytes; x < row_bytes; ++x) lanes[x & 3] = (lanes[x & 3] ^ px[x]) * k;
+	}
+
+	uint64_t h = 0;
+
+	for (const uint64_t l : lanes) h = (h ^ l) * k;
+
+	return h ^ (h >> 29);
+}
+
+std::vector<ReduceKernel> sumBGRXKernels()
+{
+	std::vector<ReduceKernel> kernels;
+
+#ifdef REDUCE_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512bw")) kernels.push_back({ "AVX-512", sumBGRXAVX512 });
+	if (__builtin_cpu_supports("avx2"))     kernels.push_back({ "AVX2", sumBGRXAVX2 });
+	if (__builtin_cpu_supports("sse2"))     kernels.push_back({ "SSE2", sumBGRXSSE2 });
+#endif
+
+	kernels.push_back({ "scalar", sumBGRXScalar });
+
+	return kernels;
+}
+
+static ReduceKernel pickKernel()
+{
+	const ReduceKernel k = sumBGRXKernels().front();
+
+	LOGD << "Reduction kernel: " << k.name;
+
+	return k;
+}
+
+void sumBGRX(const uint8_t *px, uint32_t width, uint32_t rows, size_t stride, uint64_t &r, uint64_t &g, uint64_t &b)
+{
+	static const ReduceKernel kernel = pickKernel();
+
+	kernel.sum(px, width, rows, stride, r, g, b);
+}
+
+// Gathers only pay off from AVX2 on. AVX-512 ones measured no faster
+std::vector<LinearKernel> sumLinearBGRXKernels()
+{
+	std::vector<LinearKernel> kernels;
+
+#ifdef REDUCE_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) kernels.push_back({ "AVX2", sumLinearBGRXAVX2 });
+#endif
+
+	kernels.push_back({ "scalar", sumLinearBGRXScalar });
+
+	return kernels;
+}
+
+static LinearKernel pickLinearKernel()
+{
+	const LinearKernel k = sumLinearBGRXKernels().front();
+
+	LOGD << "Linear luminance kernel: " << k.name;
+
+	return k;
+}
+
+void sumLinearBGRX(const uint8_t *px, uint32_t width, uint32_t rows, size_t stride, uint64_t &y)
+{
+	static const LinearKernel kernel = pickLinearKernel();
+
+	kernel.sum(px, width, rows, stride, y);
+}
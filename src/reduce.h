@@ -0,0 +1,50 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Adds up the channels of a block of BGRX pixels, rows apart by stride bytes.
+ * The scalar version is the reference: the vectorized ones give exactly the same sums.
+ */
+void sumBGRXScalar(const uint8_t *px, uint32_t width, uint32_t rows, size_t stride, uint64_t &r, uint64_t &g, uint64_t &b);
+
+struct ReduceKernel
+{
+	const char *name;
+	void (*sum)(const uint8_t *px, uint32_t width, uint32_t rows, size_t stride, uint64_t &r, uint64_t &g, uint64_t &b);
+};
+
+// Kernels the CPU can run, fastest first. The scalar reference is always last
+std::vector<ReduceKernel> sumBGRXKernels();
+
+// Uses the fastest kernel the CPU supports, picked on first use
+void sumBGRX(const uint8_t *px, uint32_t width, uint32_t rows, size_t stride, uint64_t &r, uint64_t &g, uint64_t &b);
+
+/**
+ * Adds up the linear luminance (Q16, from the sRGB tables) of a block of BGRX pixels.
+ * Same structure as the channel sums: a scalar reference, and gathers giving the same result.
+ */
+void sumLinearBGRXScalar(const uint8_t *px, uint32_t width, uint32_t rows, size_t stride, uint64_t &y);
+
+struct LinearKernel
+{
+	const char *name;
+	void (*sum)(const uint8_t *px, uint32_t width, uint32_t rows, size_t stride, uint64_t &y);
+};
+
+std::vector<LinearKernel> sumLinearBGRXKernels();
+
+void sumLinearBGRX(const uint8_t *px, uint32_t width, uint32_t rows, size_t stride, uint64_t &y);
+
+// Fingerprint of a block of rows, to tell whether its pixels changed
+uint64_t hashRows(const uint8_t *px, size_t row_bytes, uint32_t rows, size_t stride);
+
+#endif // REDUCE_H
@@ -0,0 +1,97 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "sampler.h"
+#include "defs.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+void BrightnessSampler::resize(uint32_t width, uint32_t height)
+{
+	w = width;
+	h = height;
+
+	pattern.clear();
+
+	// Fixed seed, so the same resolution always gets the same pattern
+	std::mt19937 rng(w * 31 + h);
+
+	for (uint32_t y = 0; y < h; y += cell_sz)
+	{
+		for (uint32_t x = 0; x < w; x += cell_sz)
+		{
+			const uint32_t cw = std::min(cell_sz, w - x);
+			const uint32_t ch = std::min(cell_sz, h - y);
+
+			pattern.push_back({ x + uint32_t(rng() % cw), y + uint32_t(rng() % ch) });
+		}
+	}
+
+	std::shuffle(pattern.begin(), pattern.end(), rng);
+
+	LOGD << "Sample pattern: " << pattern.size() << " points for " << w << '*' << h;
+}
+
+template <PixelFormat F>
+void BrightnessSampler::estimateAs(const Frame &frame, double max_error)
+{
+	const auto max = channelMax(F);
+
+	const double kr = 0.2126 * 255 / max[0];
+	const double kg = 0.7152 * 255 / max[1];
+	const double kb = 0.0722 * 255 / max[2];
+
+	// Running mean and variance (Welford)
+	double mean = 0, m2 = 0;
+	size_t n = 0;
+
+	for (const Point &p : pattern)
+	{
+		uint64_t r = 0, g = 0, b = 0;
+		Pixel<F>::add(frame.data + size_t(p.y) * frame.stride + size_t(p.x) * Pixel<F>::size, r, g, b);
+
+		const double luma  = r * kr + g * kg + b * kb;
+		const double delta = luma - mean;
+
+		mean += delta / ++n;
+		m2   += delta * (luma - mean);
+
+		if (n >= min_samples && n % 64 == 0)
+		{
+			error = 1.96 * std::sqrt(m2 / (n - 1) / n);
+
+			if (error <= max_error) break;
+		}
+	}
+
+	if (n > 1) error = 1.96 * std::sqrt(m2 / (n - 1) / n);
+
+	samples    = n;
+	brightness = int(mean);
+}
+
+int BrightnessSampler::estimate(const Frame &frame, double max_error)
+{
+	if (!frame.data || frame.w == 0 || frame.h == 0)
+	{
+		brightness = 0;
+		samples    = 0;
+		error      = 0;
+		return 0;
+	}
+
+	if (frame.w != w || frame.h != h) resize(frame.w, frame.h);
+
+	switch (frame.format)
+	{
+	case BGRX32: estimateAs<BGRX32>(frame, max_error); break;
+	case BGR24:  estimateAs<BGR24>(frame, max_error);  break;
+	case RGB565: estimateAs<RGB565>(frame, max_error); break;
+	case RGB30:  estimateAs<RGB30>(frame, max_error);  break;
+	}
+
+	return brightness;
+}
@@ -0,0 +1,49 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "utils.h"
+
+/**
+ * Estimates the brightness of a frame from a subset of its pixels.
+ * One jittered point is taken in each cell of a grid, and the cells are visited in shuffled order,
+ * so any prefix of the pattern covers the whole frame. Sampling stops once the 95% confidence
+ * interval of the mean is within the requested error.
+ */
+class BrightnessSampler
+{
+	struct Point
+	{
+		uint32_t x, y;
+	};
+
+	// Rebuilt only when the resolution changes
+	std::vector<Point> pattern;
+	uint32_t w = 0, h = 0;
+
+	template <PixelFormat F>
+	void estimateAs(const Frame &frame, double max_error);
+
+	public:
+	static constexpr uint32_t cell_sz     = 16;
+	static constexpr size_t   min_samples = 256;
+
+	// Results of the last estimate
+	int    brightness = 0;
+	size_t samples    = 0;
+	double error      = 0;
+
+	void resize(uint32_t width, uint32_t height);
+
+	// max_error is in brightness units (0-255)
+	int estimate(const Frame &frame, double max_error);
+};
+
+#endif // SAMPLER_H
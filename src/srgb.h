@@ -0,0 +1,54 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#ifndef SRGB_H
+#define SRGB_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "utils.h"
+
+/**
+ * sRGB to linear light, evaluated at compile time.
+ * x^2.4 is computed as x^2 * (x^(1/5))^2, with the fifth root found by Newton's method.
+ */
+constexpr double fifthRoot(double x)
+{
+	double y = 1;
+
+	for (int i = 0; i < 64; ++i) y = (4 * y + x / (y * y * y * y)) / 5;
+
+	return y;
+}
+
+constexpr double srgbToLinear(double c)
+{
+	if (c <= 0.04045) return c / 12.92;
+
+	const double x = (c + 0.055) / 1.055;
+	const double r = fifthRoot(x);
+
+	return x * x * r * r;
+}
+
+// Linear value of each 8-bit level, times a Q16 luma weight
+constexpr std::array<uint32_t, 256> linearLut(uint64_t weight)
+{
+	std::array<uint32_t, 256> lut {};
+
+	for (size_t v = 0; v < lut.size(); ++v) lut[v] = uint32_t(srgbToLinear(v / 255.0) * weight + 0.5);
+
+	return lut;
+}
+
+// Adding one entry of each gives the linear luminance of a pixel, in Q16
+constexpr auto linear_r = linearLut(luma_r);
+constexpr auto linear_g = linearLut(luma_g);
+constexpr auto linear_b = linearLut(luma_b);
+
+static_assert(linear_r[255] + linear_g[255] + linear_b[255] == 1 << 16, "White must be 1.0");
+
+#endif // SRGB_H
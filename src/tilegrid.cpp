@@ -0,0 +1,543 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "tilegrid.h"
+#include "reduce.h"
+#include "workerpool.h"
+#include "srgb.h"
+#include "defs.h"
+#include <algorithm>
+#include <cmath>
+
+void TileGrid::setPool(WorkerPool *workers)
+{
+	pool = workers;
+}
+
+bool TileGrid::usesHist(Metric m)
+{
+	return m == MEDIAN || m == P90 || m == GLARE;
+}
+
+void TileGrid::setMetric(Metric m, int threshold)
+{
+	glare_threshold = threshold;
+
+	if (m == metric) return;
+
+	// Metrics reading the same data per tile can switch without a new pass
+	const bool same_data = usesHist(m) ? usesHist(metric) : (m == LIGHTNESS) == (metric == LIGHTNESS);
+
+	metric = m;
+
+	if (same_data) return;
+
+	// Every tile has to be read again to fill in what the new metric needs
+	if (usesHist(m)) tile_hists.assign(tiles.size(), TileHist{});
+	else tile_hists.clear();
+
+	hist = {};
+	std::fill(dirty.begin(), dirty.end(), 1);
+	std::fill(hashed.begin(), hashed.end(), 0);
+}
+
+/**
+ * Without damage events every tile is dirty on every frame. Hashing a tile first
+ * lets its cached sums be reused when its pixels are the same as last time.
+ */
+void TileGrid::setFingerprint(bool enable)
+{
+	if (enable == fingerprint) return;
+
+	fingerprint = enable;
+
+	if (enable)
+	{
+		hashes.assign(tiles.size(), 0);
+		hashed.assign(tiles.size(), 0);
+	}
+	else
+	{
+		hashes.clear();
+		hashed.clear();
+	}
+}
+
+void TileGrid::resize(uint32_t width, uint32_t height, PixelFormat fmt)
+{
+	w = width;
+	h = height;
+	format = fmt;
+
+	cols = (w + tile_sz - 1) / tile_sz;
+	rows = (h + tile_sz - 1) / tile_sz;
+
+	tiles.assign(size_t(cols) * rows, Sums{});
+
+	if (usesHist(metric)) tile_hists.assign(size_t(cols) * rows, TileHist{});
+
+	if (fingerprint)
+	{
+		hashes.assign(size_t(cols) * rows, 0);
+		hashed.assign(size_t(cols) * rows, 0);
+	}
+
+	// Everything has to be read on the next update
+	dirty.assign(size_t(cols) * rows, 1);
+
+	total = {};
+	hist  = {};
+
+	buildWeights();
+	setPointer(pointer_fx, pointer_fy);
+
+	LOGD << "Tile grid: " << cols << '*' << rows;
+}
+
+void TileGrid::setWeighting(Weighting wt)
+{
+	weighting = wt;
+}
+
+void TileGrid::setPointer(double fx, double fy)
+{
+	// Kept, so the pointer's tile can be found again after a resize
+	pointer_fx = fx;
+	pointer_fy = fy;
+
+	pointer_col = uint32_t(clamp(int(fx * cols), 0, std::max(int(cols) - 1, 0)));
+	pointer_row = uint32_t(clamp(int(fy * rows), 0, std::max(int(rows) - 1, 0)));
+}
+
+/**
+ * Gaussian falloffs, from max_weight down to min_weight, so no part of the frame is ignored.
+ * Center: over the distance from the middle, relative to the frame size.
+ * Pointer: over the distance from the pointer, relative to the shorter side.
+ */
+void TileGrid::buildWeights()
+{
+	if (cols == 0 || rows == 0)
+	{
+		center_weights.clear();
+		pointer_weights.clear();
+		return;
+	}
+
+	const auto falloff = [] (double d2)
+	{
+		return std::max(uint32_t(max_weight * std::exp(-d2 * 2) + 0.5), min_weight);
+	};
+
+	center_weights.resize(size_t(cols) * rows);
+
+	for (uint32_t r = 0; r < rows; ++r)
+	{
+		for (uint32_t c = 0; c < cols; ++c)
+		{
+			const double dx = ((c + 0.5) * tile_sz - w / 2.0) / (w / 2.0);
+			const double dy = ((r + 0.5) * tile_sz - h / 2.0) / (h / 2.0);
+
+			center_weights[size_t(r) * cols + c] = falloff(dx * dx + dy * dy);
+		}
+	}
+
+	const uint32_t span_c = 2 * cols - 1;
+	const uint32_t span_r = 2 * rows - 1;
+	const double   side   = std::max(std::min(w, h) / 2.0, 1.0);
+
+	pointer_weights.resize(size_t(span_c) * span_r);
+
+	for (uint32_t r = 0; r < span_r; ++r)
+	{
+		for (uint32_t c = 0; c < span_c; ++c)
+		{
+			const double dx = (double(c) - (cols - 1)) * tile_sz / side;
+			const double dy = (double(r) - (rows - 1)) * tile_sz / side;
+
+			pointer_weights[size_t(r) * span_c + c] = falloff(dx * dx + dy * dy);
+		}
+	}
+}
+
+uint32_t TileGrid::weight(uint32_t i) const
+{
+	if (weighting == CENTER) return center_weights[i];
+
+	const uint32_t c = i % cols + cols - 1 - pointer_col;
+	const uint32_t r = i / cols + rows - 1 - pointer_row;
+
+	return pointer_weights[size_t(r) * (2 * cols - 1) + c];
+}
+
+uint64_t TileGrid::tilePixels(uint32_t i) const
+{
+	const uint32_t x = i % cols * tile_sz;
+	const uint32_t y = i / cols * tile_sz;
+
+	return uint64_t(std::min(tile_sz, w - x)) * std::min(tile_sz, h - y);
+}
+
+// Tile sums scaled by their weights. Once per frame, so it costs one pass over the tiles
+TileGrid::Sums TileGrid::weightedTotal(uint64_t &pixels) const
+{
+	Sums s {};
+	pixels = 0;
+
+	for (uint32_t i = 0; i < tiles.size(); ++i)
+	{
+		const uint64_t wt = weight(i);
+
+		s.r += tiles[i].r * wt;
+		s.g += tiles[i].g * wt;
+		s.b += tiles[i].b * wt;
+		s.y += tiles[i].y * wt;
+
+		pixels += tilePixels(i) * wt;
+	}
+
+	return s;
+}
+
+std::array<uint64_t, 256> TileGrid::weightedHist() const
+{
+	std::array<uint64_t, 256> wh {};
+
+	for (uint32_t i = 0; i < tile_hists.size(); ++i)
+	{
+		const uint64_t wt = weight(i);
+
+		for (size_t v = 0; v < wh.size(); ++v) wh[v] += tile_hists[i][v] * wt;
+	}
+
+	return wh;
+}
+
+template <PixelFormat F>
+TileGrid::Sums TileGrid::sumTile(const uint8_t *row_ptr, uint32_t stride, uint32_t col, uint32_t tile_rows) const
+{
+	Sums s {};
+
+	const uint32_t x0 = col * tile_sz;
+	const uint32_t x1 = std::min(x0 + tile_sz, w);
+
+	for (uint32_t y = 0; y < tile_rows; ++y)
+	{
+		const uint8_t *px = row_ptr + size_t(y) * stride + size_t(x0) * Pixel<F>::size;
+
+		for (uint32_t x = x0; x < x1; ++x, px += Pixel<F>::size)
+		{
+			Pixel<F>::add(px, s.r, s.g, s.b);
+		}
+	}
+
+	return s;
+}
+
+// The common 32-bit layout goes through the vectorized kernels
+template <>
+TileGrid::Sums TileGrid::sumTile<BGRX32>(const uint8_t *row_ptr, uint32_t stride, uint32_t col, uint32_t tile_rows) const
+{
+	Sums s {};
+
+	const uint32_t x0 = col * tile_sz;
+
+	sumBGRX(row_ptr + size_t(x0) * 4, std::min(x0 + tile_sz, w) - x0, tile_rows, stride, s.r, s.g, s.b);
+
+	return s;
+}
+
+// Scales a channel value to 8 bits, for free when it already is
+template <uint32_t max>
+static inline uint64_t level(uint64_t v)
+{
+	if constexpr (max == 255) return v;
+	else return v * 255 / max;
+}
+
+/**
+ * Sums a tile and counts its pixels by 8-bit luma in the same pass.
+ * Luma uses the Q16 weights, scaled to the channel depth of the format.
+ */
+template <PixelFormat F>
+TileGrid::Sums TileGrid::sumTileHist(const uint8_t *row_ptr, uint32_t stride, uint32_t col, uint32_t tile_rows, TileHist &th) const
+{
+	constexpr uint64_t wr = luma_r * 255 / Pixel<F>::r_max;
+	constexpr uint64_t wg = luma_g * 255 / Pixel<F>::g_max;
+	constexpr uint64_t wb = luma_b * 255 / Pixel<F>::b_max;
+
+	Sums s {};
+	th = {};
+
+	const uint32_t x0 = col * tile_sz;
+	const uint32_t x1 = std::min(x0 + tile_sz, w);
+
+	for (uint32_t y = 0; y < tile_rows; ++y)
+	{
+		const uint8_t *px = row_ptr + size_t(y) * stride + size_t(x0) * Pixel<F>::size;
+
+		for (uint32_t x = x0; x < x1; ++x, px += Pixel<F>::size)
+		{
+			uint64_t r = 0, g = 0, b = 0;
+			Pixel<F>::add(px, r, g, b);
+
+			s.r += r;
+			s.g += g;
+			s.b += b;
+
+			++th[std::min((r * wr + g * wg + b * wb) >> 16, uint64_t(255))];
+		}
+	}
+
+	return s;
+}
+
+// Adds up the linear luminance of a tile's pixels. The tables are indexed by 8-bit levels
+template <PixelFormat F>
+TileGrid::Sums TileGrid::sumTileLinear(const uint8_t *row_ptr, uint32_t stride, uint32_t col, uint32_t tile_rows) const
+{
+	Sums s {};
+
+	const uint32_t x0 = col * tile_sz;
+	const uint32_t x1 = std::min(x0 + tile_sz, w);
+
+	for (uint32_t y = 0; y < tile_rows; ++y)
+	{
+		const uint8_t *px = row_ptr + size_t(y) * stride + size_t(x0) * Pixel<F>::size;
+
+		for (uint32_t x = x0; x < x1; ++x, px += Pixel<F>::size)
+		{
+			uint64_t r = 0, g = 0, b = 0;
+			Pixel<F>::add(px, r, g, b);
+
+			s.y += linear_r[level<Pixel<F>::r_max>(r)] + linear_g[level<Pixel<F>::g_max>(g)] + linear_b[level<Pixel<F>::b_max>(b)];
+		}
+	}
+
+	return s;
+}
+
+// The common 32-bit layout goes through the vectorized kernels, same as the channel sums
+template <>
+TileGrid::Sums TileGrid::sumTileLinear<BGRX32>(const uint8_t *row_ptr, uint32_t stride, uint32_t col, uint32_t tile_rows) const
+{
+	Sums s {};
+
+	const uint32_t x0 = col * tile_sz;
+
+	sumLinearBGRX(row_ptr + size_t(x0) * 4, std::min(x0 + tile_sz, w) - x0, tile_rows, stride, s.y);
+
+	return s;
+}
+
+void TileGrid::markDamage(uint32_t width, uint32_t height, PixelFormat fmt, const std::vector<Rect> &damage)
+{
+	if (width != w || height != h || fmt != format) resize(width, height, fmt);
+
+	tiles_read = tiles_reused = 0;
+
+	for (const auto &rect : damage)
+	{
+		if (rect.w == 0 || rect.h == 0 || rect.x >= w || rect.y >= h) continue;
+
+		const uint32_t c0 = rect.x / tile_sz;
+		const uint32_t r0 = rect.y / tile_sz;
+		const uint32_t c1 = (std::min(rect.x + rect.w, w) - 1) / tile_sz;
+		const uint32_t r1 = (std::min(rect.y + rect.h, h) - 1) / tile_sz;
+
+		for (uint32_t r = r0; r <= r1; ++r)
+		{
+			std::fill(&dirty[size_t(r) * cols + c0], &dirty[size_t(r) * cols + c1] + 1, 1);
+		}
+	}
+}
+
+/**
+ * Re-reads the dirty tiles covered by a horizontal strip starting at row y.
+ * The strip has to start on a tile boundary.
+ */
+void TileGrid::sumRows(const Frame &strip, uint32_t y)
+{
+	// Dispatched once per strip, so the per-pixel loop is specialized for the format
+	switch (strip.format)
+	{
+	case BGRX32: sumRowsAs<BGRX32>(strip, y); break;
+	case BGR24:  sumRowsAs<BGR24>(strip, y);  break;
+	case RGB565: sumRowsAs<RGB565>(strip, y); break;
+	case RGB30:  sumRowsAs<RGB30>(strip, y);  break;
+	}
+}
+
+template <PixelFormat F>
+void TileGrid::sumRowsAs(const Frame &strip, uint32_t y)
+{
+	const uint32_t r0 = y / tile_sz;
+	const uint32_t r1 = std::min((y + strip.h + tile_sz - 1) / tile_sz, rows);
+
+	pending.clear();
+
+	for (uint32_t i = r0 * cols; i < r1 * cols; ++i)
+	{
+		if (dirty[i]) pending.push_back(i);
+	}
+
+	const bool with_hist   = usesHist(metric);
+	const bool with_linear = metric == LIGHTNESS;
+
+	pending_sums.resize(pending.size());
+	pending_reused.assign(pending.size(), 0);
+
+	if (with_hist) pending_hists.resize(pending.size());
+
+	// Each job only writes its own slot
+	const std::function<void(size_t)> sum = [&] (size_t k)
+	{
+		const uint32_t i         = pending[k];
+		const uint32_t r         = i / cols;
+		const uint32_t c         = i % cols;
+		const uint32_t row_y     = r * tile_sz;
+		const uint32_t tile_rows = std::min(row_y + tile_sz, h) - row_y;
+		const uint8_t *row_ptr   = strip.data + size_t(row_y - y) * strip.stride;
+
+		if (fingerprint)
+		{
+			const uint32_t x0 = c * tile_sz;
+			const size_t bytes = size_t(std::min(x0 + tile_sz, w) - x0) * Pixel<F>::size;
+
+			const uint64_t fp = hashRows(row_ptr + size_t(x0) * Pixel<F>::size, bytes, tile_rows, strip.stride);
+
+			// Same pixels, same sums
+			if (hashed[i] && hashes[i] == fp)
+			{
+				pending_sums[k] = tiles[i];
+				if (with_hist) pending_hists[k] = tile_hists[i];
+
+				pending_reused[k] = 1;
+				return;
+			}
+
+			hashes[i] = fp;
+			hashed[i] = 1;
+		}
+
+		if (with_hist) pending_sums[k] = sumTileHist<F>(row_ptr, strip.stride, c, tile_rows, pending_hists[k]);
+		else if (with_linear) pending_sums[k] = sumTileLinear<F>(row_ptr, strip.stride, c, tile_rows);
+		else pending_sums[k] = sumTile<F>(row_ptr, strip.stride, c, tile_rows);
+	};
+
+	if (pool && pending.size() >= min_parallel_tiles) pool->run(pending.size(), sum);
+	else for (size_t k = 0; k < pending.size(); ++k) sum(k);
+
+	// Combined in tile order, whatever thread summed them
+	for (size_t k = 0; k < pending.size(); ++k)
+	{
+		const uint32_t i = pending[k];
+		const Sums &s    = pending_sums[k];
+
+		total.r += s.r - tiles[i].r;
+		total.g += s.g - tiles[i].g;
+		total.b += s.b - tiles[i].b;
+		total.y += s.y - tiles[i].y;
+
+		tiles[i] = s;
+		dirty[i] = 0;
+
+		if (pending_reused[k]) ++tiles_reused;
+		else ++tiles_read;
+
+		if (!with_hist) continue;
+
+		const TileHist &th = pending_hists[k];
+
+		for (size_t v = 0; v < th.size(); ++v) hist[v] += th[v] - tile_hists[i][v];
+
+		tile_hists[i] = th;
+	}
+}
+
+int TileGrid::mean() const
+{
+	uint64_t pixels = uint64_t(w) * h;
+
+	const Sums s = weighting == UNIFORM ? total : weightedTotal(pixels);
+
+	// Scale the sums to 8 bits per channel
+	const auto max = channelMax(format);
+
+	return calcLuminance(s.r * 255 / max[0], s.g * 255 / max[1], s.b * 255 / max[2], pixels);
+}
+
+// Lowest luma that at least pct% of the (weighted) pixels are at or below
+int TileGrid::percentile(unsigned pct) const
+{
+	const auto hg = weighting == UNIFORM ? hist : weightedHist();
+
+	uint64_t pixels = 0;
+
+	for (const auto n : hg) pixels += n;
+
+	const uint64_t rank = std::max((pixels * pct + 99) / 100, uint64_t(1));
+
+	uint64_t count = 0;
+
+	for (size_t v = 0; v < hg.size(); ++v)
+	{
+		count += hg[v];
+		if (count >= rank) return int(v);
+	}
+
+	return 255;
+}
+
+// Share of (weighted) pixels at or above the glare threshold
+double TileGrid::glareFraction() const
+{
+	const auto hg = weighting == UNIFORM ? hist : weightedHist();
+
+	uint64_t pixels = 0, count = 0;
+
+	for (size_t v = 0; v < hg.size(); ++v)
+	{
+		pixels += hg[v];
+		if (int(v) >= glare_threshold) count += hg[v];
+	}
+
+	if (pixels == 0) return 0;
+
+	return double(count) / pixels;
+}
+
+// Perceived lightness (CIE L*) of the mean linear luminance, scaled to 0-255
+int TileGrid::lightness() const
+{
+	uint64_t pixels = uint64_t(w) * h;
+
+	const Sums s = weighting == UNIFORM ? total : weightedTotal(pixels);
+
+	return calcLightness(s.y, pixels);
+}
+
+int TileGrid::brightness() const
+{
+	switch (metric)
+	{
+	case MEDIAN:    return percentile(50);
+	case P90:       return percentile(90);
+	case GLARE:     return int(glareFraction() * 255);
+	case LIGHTNESS: return lightness();
+	default:        return mean();
+	}
+}
+
+/**
+ * Re-reads the tiles intersecting the damage rectangles and updates the totals incrementally.
+ * Returns the brightness of the whole frame.
+ */
+int TileGrid::update(const Frame &frame)
+{
+	markDamage(frame.w, frame.h, frame.format, *frame.damage);
+	sumRows(frame, 0);
+
+	return brightness();
+}
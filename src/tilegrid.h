@@ -0,0 +1,137 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#ifndef TILEGRID_H
+#define TILEGRID_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "utils.h"
+
+class WorkerPool;
+
+/**
+ * Keeps the channel sums of each tile of a frame across snapshots,
+ * so that only the tiles touched by damage have to be read again.
+ */
+class TileGrid
+{
+	struct Sums
+	{
+		uint64_t r, g, b;
+
+		// Linear-light luminance in Q16, only kept for LIGHTNESS
+		uint64_t y;
+	};
+
+	// Pixel count of each 8-bit luma value. A tile has at most 4096 pixels
+	using TileHist = std::array<uint16_t, 256>;
+
+	std::vector<Sums>     tiles;
+	std::vector<TileHist> tile_hists;
+	std::vector<uint8_t>  dirty;
+
+	Sums total {};
+	std::array<uint64_t, 256> hist {};
+
+	uint32_t w = 0, h = 0;
+	uint32_t cols = 0, rows = 0;
+
+	PixelFormat format = BGRX32;
+
+	// Dirty tiles of the current strip, summed in any order and combined in this one
+	std::vector<uint32_t> pending;
+	std::vector<Sums>     pending_sums;
+	std::vector<TileHist> pending_hists;
+
+	WorkerPool *pool = nullptr;
+
+	// Fingerprints of the pixels each tile was last summed from
+	std::vector<uint64_t> hashes;
+	std::vector<uint8_t>  hashed;
+	std::vector<uint8_t>  pending_reused;
+	bool fingerprint = false;
+
+	// Per-tile weights, built once per resolution. The pointer table is indexed by the
+	// offset of a tile from the pointer's tile, so following the pointer is only a lookup
+	std::vector<uint32_t> center_weights;
+	std::vector<uint32_t> pointer_weights;
+	double   pointer_fx = 0.5, pointer_fy = 0.5;
+	uint32_t pointer_col = 0, pointer_row = 0;
+
+	void buildWeights();
+	uint32_t weight(uint32_t i) const;
+	uint64_t tilePixels(uint32_t i) const;
+	Sums weightedTotal(uint64_t &pixels) const;
+	std::array<uint64_t, 256> weightedHist() const;
+
+	// Below this, handing tiles to the pool costs more than it saves
+	static constexpr size_t min_parallel_tiles = 8;
+
+	template <PixelFormat F>
+	Sums sumTile(const uint8_t *row_ptr, uint32_t stride, uint32_t col, uint32_t tile_rows) const;
+
+	template <PixelFormat F>
+	Sums sumTileHist(const uint8_t *row_ptr, uint32_t stride, uint32_t col, uint32_t tile_rows, TileHist &th) const;
+
+	template <PixelFormat F>
+	Sums sumTileLinear(const uint8_t *row_ptr, uint32_t stride, uint32_t col, uint32_t tile_rows) const;
+
+	template <PixelFormat F>
+	void sumRowsAs(const Frame &strip, uint32_t y);
+
+	public:
+	static constexpr uint32_t tile_sz = 64;
+
+	// What brightness() reports. MEDIAN, P90 and GLARE need a luma histogram of each tile,
+	// LIGHTNESS a sum of linear luminance, and MEAN only the channel sums
+	enum Metric
+	{
+		MEAN, MEDIAN, P90, GLARE, LIGHTNESS
+	};
+
+	Metric metric = MEAN;
+
+	static bool usesHist(Metric m);
+	int glare_threshold = 230;
+
+	void setMetric(Metric m, int threshold);
+
+	// How much each tile counts towards the result
+	enum Weighting
+	{
+		UNIFORM, CENTER, POINTER
+	} weighting = UNIFORM;
+
+	static constexpr uint32_t max_weight = 256;
+	static constexpr uint32_t min_weight = 16;
+
+	void setWeighting(Weighting wt);
+
+	// Pointer position as a fraction of the frame size
+	void setPointer(double fx, double fy);
+
+	int mean() const;
+	int percentile(unsigned pct) const;
+	double glareFraction() const;
+	int lightness() const;
+
+	// Tiles summed, and tiles whose fingerprint matched, since the last markDamage
+	uint32_t tiles_read   = 0;
+	uint32_t tiles_reused = 0;
+
+	void setFingerprint(bool enable);
+	void setPool(WorkerPool *workers);
+	void resize(uint32_t width, uint32_t height, PixelFormat fmt);
+	void markDamage(uint32_t width, uint32_t height, PixelFormat fmt, const std::vector<Rect> &damage);
+	void sumRows(const Frame &strip, uint32_t y);
+	int brightness() const;
+
+	int update(const Frame &frame);
+};
+
+#endif // TILEGRID_H
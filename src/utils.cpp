@@ -10,6 +10,7 @@
 #include "utils.h"
 #include "cfg.h"
 #include "defs.h"
+#include <cmath>
 
 double lerp(double start, double end, double factor)
 {
@@ -43,31 +44,43 @@ void setColors(int temp_step, std::array<double, 3> &c)
 	c[2] = interpTemp(2);
 };
 
-int calcBrightness(const std::vector<uint8_t> &buf)
+int calcLuminance(uint64_t r, uint64_t g, uint64_t b, uint64_t pixels)
 {
-	LOGV << "Calculating brightness";
-	uint64_t r{}, g{}, b{};
+	/*
+	* Luminance of the gamma-encoded sums, converted to a 0-255 range.
+	* calcLightness gives the perceived lightness instead, as explained here: stackoverflow.com/a/56678483
+	*/
+	if (pixels == 0) return 0;
 
-	static const uint64_t len = buf.size();
+	// All integer, so results don't depend on the compiler's floating point
+	return int((r * luma_r + g * luma_g + b * luma_b) / (pixels << 16));
+}
 
-	// Remove the last 4 bits to avoid going out of bounds
-	for (auto i = len - 4; i > 0; i -= 4)
-	{
-		r += buf[i + 2];
-		g += buf[i + 1];
-		b += buf[i];
-	}
+/**
+ * Converts a sum of linear luminance (Q16 per pixel) to CIE L*, scaled to 0-255.
+ * Only runs once per frame: the per-pixel work is in the sRGB lookup tables.
+ */
+int calcLightness(uint64_t y, uint64_t pixels)
+{
+	if (pixels == 0) return 0;
 
-	/*
-	* The proper way would be to calculate perceived lightness as explained here: stackoverflow.com/a/56678483
-	* But that's too heavy. We calculate luminance only, which still gives okay results.
-	* Here it's converted to a 0-255 range by the RGB sums.
-	*/
-	const static auto screen_res = len / 4;
+	const double lum = double(y) / double(pixels << 16);
+
+	// Below (6/29)^3 the curve is linear
+	const double l = lum > 216.0 / 24389 ? 116 * std::cbrt(lum) - 16 : lum * 24389 / 27;
+
+	return clamp(int(l * 255 / 100), 0, 255);
+}
 
-	int brightness = int((r * 0.2126 + g * 0.7152 + b * 0.0722) / screen_res);
+/**
+ * Maps a screen brightness (0-255) to the brightness step it calls for:
+ * brighter screens get dimmer steps, shifted by offset and kept within [min_br, max_br].
+ */
+int calcBrightnessTarget(int img_br, int offset, int min_br, int max_br)
+{
+	const int target = brt_slider_steps - img_br * brt_slider_steps / 255 + offset;
 
-	return brightness;
+	return clamp(target, min_br, max_br);
 }
 
 double easeOutExpo(double t, double b , double c, double d)
@@ -7,7 +7,9 @@
 #define UTILS_H
 
 #include <array>
+#include <cstdint>
 #include <vector>
+#include "pixelformat.h"
 
 double lerp(double start, double end, double factor);
 double normalize(double start, double end, double value);
@@ -16,9 +18,33 @@ int roundup(int val, int multiple);
 
 int clamp(int v, int lo, int hi);
 
+struct Rect
+{
+	uint32_t x, y, w, h;
+};
+
+// A captured image, along with the regions that changed since the previous one
+struct Frame
+{
+	const uint8_t *data;
+	uint32_t w, h;
+	uint32_t stride;
+	PixelFormat format;
+	const std::vector<Rect> *damage;
+};
+
 void setColors(int temp, std::array<double, 3> &c);
 
-int calcBrightness(const std::vector<uint8_t> &buf);
+// Rec. 709 luma weights in Q16 fixed point, adding up to exactly 1.0
+constexpr uint64_t luma_r = 13933;
+constexpr uint64_t luma_g = 46871;
+constexpr uint64_t luma_b = 4732;
+
+static_assert(luma_r + luma_g + luma_b == 1 << 16, "Luma weights must add up to 1.0");
+
+int calcLuminance(uint64_t r, uint64_t g, uint64_t b, uint64_t pixels);
+int calcLightness(uint64_t y, uint64_t pixels);
+int calcBrightnessTarget(int img_br, int offset, int min_br, int max_br);
 
 // Windows functions
 
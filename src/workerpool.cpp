@@ -0,0 +1,88 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "workerpool.h"
+
+WorkerPool::WorkerPool(unsigned threads)
+{
+	for (unsigned i = 1; i < threads; ++i) workers.emplace_back(&WorkerPool::work, this);
+
+	LOGD << "Worker pool: " << threads << " thread(s)";
+}
+
+size_t WorkerPool::size() const
+{
+	return workers.size() + 1;
+}
+
+void WorkerPool::drain()
+{
+	for (size_t i = next_job++; i < job_count; i = next_job++) (*job)(i);
+}
+
+void WorkerPool::work()
+{
+	uint64_t seen = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m);
+
+			start_cv.wait(lock, [&] { return quit || batch != seen; });
+
+			if (quit) return;
+
+			seen = batch;
+		}
+
+		drain();
+
+		std::lock_guard<std::mutex> lock(m);
+
+		if (--busy == 0) done_cv.notify_one();
+	}
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)> &fn)
+{
+	if (workers.empty() || count < 2)
+	{
+		for (size_t i = 0; i < count; ++i) fn(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m);
+
+		job       = &fn;
+		job_count = count;
+		next_job  = 0;
+		busy      = workers.size();
+		++batch;
+	}
+
+	start_cv.notify_all();
+
+	drain();
+
+	// Every worker has to be out of fn before it goes out of scope
+	std::unique_lock<std::mutex> lock(m);
+	done_cv.wait(lock, [&] { return busy == 0; });
+
+	job = nullptr;
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		quit = true;
+	}
+
+	start_cv.notify_all();
+
+	for (auto &t : workers) t.join();
+}
@@ -0,0 +1,50 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "defs.h"
+
+/**
+ * Threads kept alive across frames, which split the jobs of a batch between them.
+ * The calling thread takes part in each batch, so a pool of n threads runs n-1 workers.
+ */
+class WorkerPool
+{
+	std::vector<std::thread> workers;
+
+	std::mutex m;
+	convar start_cv;
+	convar done_cv;
+
+	const std::function<void(size_t)> *job = nullptr;
+	size_t job_count = 0;
+	std::atomic<size_t> next_job {0};
+
+	size_t   busy  = 0;
+	uint64_t batch = 0;
+	bool     quit  = false;
+
+	void work();
+	void drain();
+
+	public:
+	explicit WorkerPool(unsigned threads);
+
+	size_t size() const;
+
+	// Runs fn(0) to fn(count - 1) and returns when all of them are done
+	void run(size_t count, const std::function<void(size_t)> &fn);
+
+	~WorkerPool();
+};
+
+#endif // WORKERPOOL_H
@@ -5,12 +5,16 @@
 
 #include "x11.h"
 #include <iostream>
-#include <cstring>
 #include <X11/Xutil.h>
 #include <X11/extensions/xf86vmode.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <poll.h>
+#include <X11/Xatom.h>
 #include "utils.h"
 #include "defs.h"
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 
 X11::X11()
@@ -33,80 +37,1371 @@ X11::X11()
 	w = uint32_t(scr->width);
 	h = uint32_t(scr->height);
 
-	// Query XF86Vidmode extension
+	initPixelFormat();
+	initShm();
+	initDamage();
+	initRandr();
+	planOutputs();
+	initGamma();
+
+	if (gamma_crtcs.empty())
+	{
+		LOGF << "Neither XRandR nor XF86VidMode can set gamma";
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Reads the screen's XF86VidMode ramp size and initial ramp, the first time it succeeds.
+ * Only needed when XRandR can't set gamma per CRTC, so servers without the extension (e.g. Xvfb) still work.
+ */
+bool X11::initXF86Gamma()
+{
+	if (ramp_sz > 0) return true;
+
+	int ev_base, err_base;
+
+	if (!XF86VidModeQueryExtension(dsp, &ev_base, &err_base))
+	{
+		LOGW << "Failed to query XF86VidMode extension";
+		return false;
+	}
+
+	int major_ver = 0, minor_ver = 0;
+
+	if (!XF86VidModeQueryVersion(dsp, &major_ver, &minor_ver))
+	{
+		LOGW << "Failed to query XF86VidMode version";
+	}
+
+	LOGD << "XF86VidMode ver: " << major_ver << '.' << minor_ver;
+
+	int sz = 0;
+
+	if (!XF86VidModeGetGammaRampSize(dsp, scr_num, &sz) || sz <= 0)
+	{
+		LOGE << "Failed to get XF86 gamma ramp size";
+		return false;
+	}
+
+	ramp_sz = sz;
+	init_ramp.resize(3 * size_t(ramp_sz));
+
+	uint16_t *d = init_ramp.data(),
+		 *r = &d[0 * ramp_sz],
+		 *g = &d[1 * ramp_sz],
+		 *b = &d[2 * ramp_sz];
+
+	if (!XF86VidModeGetGammaRamp(dsp, scr_num, ramp_sz, r, g, b))
+	{
+		LOGE << "Failed to get initial gamma ramp";
+		initial_ramp_exists = false;
+	}
+
+	return true;
+}
+
+void X11::initPixelFormat()
+{
+	const Visual *vis = DefaultVisual(dsp, scr_num);
+	const int depth   = DefaultDepth(dsp, scr_num);
+
+	int bpp = 0, count = 0;
+
+	XPixmapFormatValues *formats = XListPixmapFormats(dsp, &count);
+
+	for (int i = 0; i < count; ++i)
+	{
+		if (formats[i].depth == depth) bpp = formats[i].bits_per_pixel;
+	}
+
+	if (formats) XFree(formats);
+
+	const auto masks = [vis] (unsigned long r, unsigned long g, unsigned long b)
+	{
+		return vis->red_mask == r && vis->green_mask == g && vis->blue_mask == b;
+	};
+
+	const bool lsb_first = ImageByteOrder(dsp) == LSBFirst;
+
+	if (lsb_first && bpp == 32 && masks(0xff0000, 0xff00, 0xff))
+	{
+		pixel_format = BGRX32;
+	}
+	else if (lsb_first && bpp == 24 && masks(0xff0000, 0xff00, 0xff))
+	{
+		pixel_format = BGR24;
+	}
+	else if (lsb_first && bpp == 16 && masks(0xf800, 0x7e0, 0x1f))
+	{
+		pixel_format = RGB565;
+	}
+	else if (lsb_first && bpp == 32 && masks(0x3ff00000, 0xffc00, 0x3ff))
+	{
+		pixel_format = RGB30;
+	}
+	else
+	{
+		LOGW << "Unsupported pixel format (depth " << depth << ", " << bpp << " bpp). Assuming BGRX";
+		pixel_format = BGRX32;
+	}
+
+	LOGD << "Pixel format: " << pixel_format << " (depth " << depth << ", " << bpp << " bpp)";
+}
+
+PixelFormat X11::getPixelFormat() const
+{
+	return pixel_format;
+}
+
+static bool x_error_caught = false;
+
+static int trapErrorHandler(Display *, XErrorEvent *)
+{
+	x_error_caught = true;
+	return 0;
+}
+
+void X11::initShm()
+{
+	int major, minor;
+	Bool pixmaps;
+
+	if (!XShmQueryVersion(dsp, &major, &minor, &pixmaps))
+	{
+		LOGW << "MIT-SHM unavailable. Using XGetImage";
+		return;
+	}
+
+	shm_available = true;
+	shm_pixmaps   = pixmaps && XShmPixmapFormat(dsp) == ZPixmap;
+
+	LOGD << "MIT-SHM available";
+}
+
+/**
+ * Turns MIT-SHM captures off, so they go through XGetImage, or back on if the server has it.
+ */
+void X11::setShm(bool enable)
+{
+	if (!enable)
+	{
+		for (auto &o : outputs) destroyShmImage(o.shm);
+
+		freeStrips();
+		shm_available = shm_pixmaps = false;
+	}
+	else if (!shm_available) initShm();
+
+	setCaptureMode(capture_mode);
+}
+
+bool X11::createShmImage(ShmImage &s, unsigned width, unsigned height, bool with_pixmap)
+{
+	const unsigned depth = unsigned(DefaultDepth(dsp, scr_num));
+
+	XImage *img = XShmCreateImage(dsp, DefaultVisual(dsp, scr_num), depth, ZPixmap, nullptr, &s.info, width, height);
+
+	if (!img)
+	{
+		LOGW << "XShmCreateImage failed. Using XGetImage";
+		return false;
+	}
+
+	s.info.shmid = shmget(IPC_PRIVATE, size_t(img->bytes_per_line) * size_t(img->height), IPC_CREAT | 0600);
+
+	if (s.info.shmid < 0)
+	{
+		LOGW << "shmget failed. Using XGetImage";
+		XDestroyImage(img);
+		return false;
+	}
+
+	s.info.shmaddr = img->data = static_cast<char*>(shmat(s.info.shmid, nullptr, 0));
+	s.info.readOnly = False;
+
+	// The attach fails asynchronously on remote displays, so trap the error and sync
+	x_error_caught = false;
+	const auto prev_handler = XSetErrorHandler(trapErrorHandler);
+
+	if (s.info.shmaddr != reinterpret_cast<char*>(-1))
+	{
+		XShmAttach(dsp, &s.info);
+		XSync(dsp, False);
+	}
+	else x_error_caught = true;
+
+	XSetErrorHandler(prev_handler);
+
+	// Removed as soon as both sides detach
+	shmctl(s.info.shmid, IPC_RMID, nullptr);
+
+	if (x_error_caught)
+	{
+		LOGW << "XShmAttach failed. Using XGetImage";
+
+		if (s.info.shmaddr != reinterpret_cast<char*>(-1)) shmdt(s.info.shmaddr);
+
+		img->data = nullptr;
+		XDestroyImage(img);
+
+		shm_available = false;
+		return false;
+	}
+
+	s.img  = img;
+	s.size = size_t(img->bytes_per_line) * size_t(img->height);
+
+	if (with_pixmap)
+	{
+		s.pixmap = XShmCreatePixmap(dsp, root, img->data, &s.info, width, height, depth);
+	}
+
+	return true;
+}
+
+void X11::destroyShmImage(ShmImage &s)
+{
+	if (!s.img) return;
+
+	if (s.pixmap) XFreePixmap(dsp, s.pixmap);
+
+	XShmDetach(dsp, &s.info);
+	shmdt(s.info.shmaddr);
+
+	// The data pointer belongs to the segment, not to Xlib
+	s.img->data = nullptr;
+	XDestroyImage(s.img);
+
+	s = ShmImage();
+}
+
+/**
+ * Makes an image hold width*height pixels. The segment is kept when it's large enough,
+ * so it's only replaced when the capture area grows.
+ */
+bool X11::fitShmImage(ShmImage &s, unsigned width, unsigned height, bool with_pixmap)
+{
+	if (s.img && bool(s.pixmap) == with_pixmap)
+	{
+		if (with_pixmap)
+		{
+			// Pixmap copies land at the pixmap's own stride
+			if (unsigned(s.img->width) >= width && unsigned(s.img->height) >= height) return true;
+		}
+		else
+		{
+			const int stride = (int(width) * s.img->bits_per_pixel + 31) / 32 * 4;
+
+			if (size_t(stride) * height <= s.size)
+			{
+				s.img->width  = int(width);
+				s.img->height = int(height);
+				s.img->bytes_per_line = stride;
+				return true;
+			}
+		}
+	}
+
+	destroyShmImage(s);
+
+	return shm_available && createShmImage(s, width, height, with_pixmap);
+}
+
+void X11::initDamage()
+{
+	ev_dsp = XOpenDisplay(nullptr);
+
+	if (!ev_dsp)
+	{
+		LOGW << "Failed to open event display. Capturing every poll";
+		return;
+	}
+
+	int err_base;
+
+	if (!XDamageQueryExtension(ev_dsp, &damage_ev_base, &err_base))
+	{
+		LOGW << "XDamage unavailable. Capturing every poll";
+		return;
+	}
+
+	int fixes_major = 2, fixes_minor = 0;
+
+	if (!XFixesQueryExtension(ev_dsp, &err_base, &err_base) || !XFixesQueryVersion(ev_dsp, &fixes_major, &fixes_minor))
+	{
+		LOGW << "XFixes unavailable. Capturing every poll";
+		return;
+	}
+
+	damage = XDamageCreate(ev_dsp, DefaultRootWindow(ev_dsp), XDamageReportNonEmpty);
+	damage_region = XFixesCreateRegion(ev_dsp, nullptr, 0);
+	XFlush(ev_dsp);
+
+	use_damage = true;
+
+	net_active_window = XInternAtom(ev_dsp, "_NET_ACTIVE_WINDOW", False);
+
+	int major = 0, minor = 2;
+
+	use_composite = XCompositeQueryExtension(dsp, &err_base, &err_base) && XCompositeQueryVersion(dsp, &major, &minor) && (major > 0 || minor >= 2);
+
+	LOGD << "XDamage capture gating enabled";
+}
+
+void X11::processEvents()
+{
+	while (XPending(ev_dsp))
+	{
+		XEvent ev;
+		XNextEvent(ev_dsp, &ev);
+
+		if (ev.type == damage_ev_base + XDamageNotify)
+		{
+			damaged = true;
+		}
+		else if (ev.type == PropertyNotify && ev.xproperty.atom == net_active_window)
+		{
+			window_changed = true;
+		}
+		else if (ev.type == ConfigureNotify || ev.type == UnmapNotify || ev.type == DestroyNotify)
+		{
+			// The tracked window moved, resized or went away
+			window_changed = true;
+		}
+		else if (use_randr && (ev.type == randr_ev_base + RRScreenChangeNotify || ev.type == randr_ev_base + RRNotify))
+		{
+			// Keeps the event display's screen size current
+			XRRUpdateConfiguration(&ev);
+			screen_changed = true;
+		}
+	}
+}
+
+/**
+ * Blocks until the screen has been damaged since the last call, or until the timeout expires.
+ * Returns false on timeout. Without XDamage, it always returns true immediately.
+ */
+bool X11::waitForDamage(int timeout_ms)
+{
+	if (ev_dsp) processEvents();
+
+	// A monitor was plugged in or removed, or a mode changed
+	if (screen_changed)
+	{
+		screen_changed = window_changed = false;
+		updateScreenSize();
+		planOutputs();
+		initGamma();
+	}
+
+	// Focus changed, or the active window was reconfigured
+	if (window_changed)
+	{
+		window_changed = false;
+		planOutputs();
+	}
+
+	if (!use_damage || full_damage)
+	{
+		if (use_damage)
+		{
+			// Must reach the server before the capture, or damage made until then is wiped without an event
+			XDamageSubtract(ev_dsp, damage, None, None);
+			XSync(ev_dsp, False);
+		}
+
+		for (auto &o : outputs) o.damage.assign(1, Rect{0, 0, o.rect.w, o.rect.h});
+
+		damaged = full_damage = false;
+		return true;
+	}
+
+	if (!damaged)
+	{
+		pollfd pfd { ConnectionNumber(ev_dsp), POLLIN, 0 };
+
+		if (poll(&pfd, 1, timeout_ms) > 0)
+		{
+			processEvents();
+		}
+
+		// Focus and layout changes are picked up right away
+		if (window_changed || screen_changed) return waitForDamage(0);
+
+		if (!damaged) return false;
+	}
+
+	// Clear the damage before capturing, so changes made during the capture aren't lost
+	damaged = false;
+
+	XDamageSubtract(ev_dsp, damage, None, damage_region);
+
+	int count = 0;
+	XRectangle *rects = XFixesFetchRegion(ev_dsp, damage_region, &count);
+
+	damage_rects.clear();
+
+	for (int i = 0; i < count; ++i)
+	{
+		const int x = std::max(int(rects[i].x), 0);
+		const int y = std::max(int(rects[i].y), 0);
+		const int rw = int(rects[i].x) + rects[i].width - x;
+		const int rh = int(rects[i].y) + rects[i].height - y;
+
+		if (rw > 0 && rh > 0) damage_rects.push_back({uint32_t(x), uint32_t(y), uint32_t(rw), uint32_t(rh)});
+	}
+
+	if (rects) XFree(rects);
+
+	// Clip the damage to each output, relative to its origin
+	bool any = false;
+
+	for (auto &o : outputs)
+	{
+		o.damage.clear();
+
+		for (const auto &r : damage_rects)
+		{
+			const uint32_t x0 = std::max(r.x, o.rect.x);
+			const uint32_t y0 = std::max(r.y, o.rect.y);
+			const uint32_t x1 = std::min(r.x + r.w, o.rect.x + o.rect.w);
+			const uint32_t y1 = std::min(r.y + r.h, o.rect.y + o.rect.h);
+
+			if (x0 < x1 && y0 < y1) o.damage.push_back({x0 - o.rect.x, y0 - o.rect.y, x1 - x0, y1 - y0});
+		}
+
+		any |= !o.damage.empty();
+	}
+
+	// Nothing changed in the captured areas
+	return any;
+}
+
+void X11::initRandr()
+{
+	int err_base;
+
+	if (!XRRQueryExtension(dsp, &randr_ev_base, &err_base))
+	{
+		LOGW << "XRandR unavailable. Capturing the whole screen as one output";
+		return;
+	}
+
+	int major, minor;
+
+	if (!XRRQueryVersion(dsp, &major, &minor) || (major == 1 && minor < 3))
+	{
+		LOGW << "XRandR 1.3 required. Capturing the whole screen as one output";
+		return;
+	}
+
+	use_randr = true;
+
+	// Hotplug and mode changes are handled without restarting
+	if (ev_dsp)
+	{
+		XRRSelectInput(ev_dsp, DefaultRootWindow(ev_dsp), RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask);
+		XFlush(ev_dsp);
+	}
+}
+
+void X11::updateScreenSize()
+{
+	const Screen *ev_scr = DefaultScreenOfDisplay(ev_dsp);
+
+	const auto new_w = unsigned(ev_scr->width);
+	const auto new_h = unsigned(ev_scr->height);
+
+	if (new_w != w || new_h != h)
+	{
+		LOGI << "Screen resized: " << w << '*' << h << " -> " << new_w << '*' << new_h;
+	}
+	else LOGD << "Output layout changed";
+
+	w = new_w;
+	h = new_h;
+}
+
+void X11::addOutput(const Rect &rect, RRCrtc crtc)
+{
+	Output o;
+	o.rect  = rect;
+	o.crtc  = crtc;
+	o.src   = root;
+	o.src_x = int(rect.x);
+	o.src_y = int(rect.y);
+
+	outputs.push_back(std::move(o));
+
+	LOGD << "Output " << outputs.size() - 1 << ": " << rect.w << '*' << rect.h << '+' << rect.x << '+' << rect.y;
+}
+
+/**
+ * Rebuilds the list of capture rectangles: each active CRTC when per-output capture is on,
+ * otherwise the whole root window. The outputs take over the previous SHM segments,
+ * which are only replaced when they are too small.
+ */
+void X11::planOutputs()
+{
+	// Segments are handed over to the new outputs, and only reallocated if they have to grow
+	std::vector<ShmImage> old_shm;
+
+	for (auto &o : outputs) old_shm.push_back(o.shm);
+
+	outputs.clear();
+
+	if (active_pixmap)
+	{
+		XFreePixmap(dsp, active_pixmap);
+		active_pixmap = 0;
+	}
+
+	if (capture_window && planActiveWindow())
+	{
+		// The active window is the only output
+	}
+	else if (per_output && use_randr)
+	{
+		XRRScreenResources *res = XRRGetScreenResourcesCurrent(dsp, root);
+
+		for (int i = 0; res && i < res->ncrtc; ++i)
+		{
+			XRRCrtcInfo *info = XRRGetCrtcInfo(dsp, res, res->crtcs[i]);
+
+			if (!info) continue;
+
+			// Disabled CRTCs have no mode. Parts outside the root window can't be captured
+			if (info->mode != None && info->x >= 0 && info->y >= 0 && unsigned(info->x) < w && unsigned(info->y) < h)
+			{
+				const auto x  = uint32_t(info->x);
+				const auto y  = uint32_t(info->y);
+				const auto cw = std::min(info->width, w - x);
+				const auto ch = std::min(info->height, h - y);
+
+				if (cw > 0 && ch > 0) addOutput(Rect{x, y, cw, ch}, res->crtcs[i]);
+			}
+
+			XRRFreeCrtcInfo(info);
+		}
+
+		if (res) XRRFreeScreenResources(res);
+	}
+
+	if (outputs.empty()) addOutput(Rect{0, 0, w, h}, 0);
+
+	for (size_t i = 0; i < old_shm.size(); ++i)
+	{
+		if (i < outputs.size()) outputs[i].shm = old_shm[i];
+		else destroyShmImage(old_shm[i]);
+	}
+
+	// Everything has to be captured again
+	for (auto &o : outputs) o.damage.assign(1, Rect{0, 0, o.rect.w, o.rect.h});
+
+	damaged = full_damage = true;
+
+	thumb_output = SIZE_MAX;
+
+	setCaptureMode(capture_mode);
+}
+
+void X11::setPerOutput(bool enable)
+{
+	if (enable == per_output) return;
+
+	per_output = enable;
+	planOutputs();
+}
+
+/**
+ * Makes the top-level frame of the window in _NET_ACTIVE_WINDOW the only output.
+ * Its composite pixmap is read when available, so overlapping windows don't contribute.
+ * Returns false if there's no usable active window.
+ */
+bool X11::planActiveWindow()
+{
+	Atom type;
+	int format;
+	unsigned long count, remaining;
+	unsigned char *prop = nullptr;
+
+	Window active = 0;
+
+	if (XGetWindowProperty(dsp, root, net_active_window, 0, 1, False, XA_WINDOW, &type, &format, &count, &remaining, &prop) == Success && prop)
+	{
+		if (count == 1 && format == 32) active = *reinterpret_cast<Window*>(prop);
+		XFree(prop);
+	}
+
+	/* _NET_ACTIVE_WINDOW can still name a window that is being closed, so any of these
+	*  requests may fail with BadWindow. Errors are trapped and mean there's no active window */
+	x_error_caught = false;
+	const auto prev_handler = XSetErrorHandler(trapErrorHandler);
+
+	// Walk up to the child of the root window, which is the one the compositor redirects
+	Window toplevel = active;
+
+	while (toplevel)
+	{
+		Window root_ret, parent, *children = nullptr;
+		unsigned nchildren;
+
+		if (!XQueryTree(dsp, toplevel, &root_ret, &parent, &children, &nchildren))
+		{
+			toplevel = 0;
+			break;
+		}
+
+		if (children) XFree(children);
+
+		if (parent == root) break;
+
+		toplevel = parent;
+	}
+
+	XWindowAttributes attr;
+
+	const bool viewable = toplevel && XGetWindowAttributes(dsp, toplevel, &attr) && attr.map_state == IsViewable;
+
+	XSync(dsp, False);
+	XSetErrorHandler(prev_handler);
+
+	if (x_error_caught) toplevel = 0;
+	if (!trackToplevel(toplevel)) toplevel = 0;
+
+	if (!toplevel || !viewable)
+	{
+		LOGD << "No active window. Capturing outputs";
+		return false;
+	}
+
+	// On-screen area of the window, without borders
+	const int x0 = std::max(attr.x + attr.border_width, 0);
+	const int y0 = std::max(attr.y + attr.border_width, 0);
+	const int x1 = std::min(attr.x + attr.border_width + attr.width, int(w));
+	const int y1 = std::min(attr.y + attr.border_width + attr.height, int(h));
+
+	if (x0 >= x1 || y0 >= y1) return false;
+
+	addOutput(Rect{uint32_t(x0), uint32_t(y0), uint32_t(x1 - x0), uint32_t(y1 - y0)}, 0);
+
+	// Read the window's own pixels when it's redirected and matches the capture depth
+	if (use_composite && attr.depth == DefaultDepth(dsp, scr_num))
+	{
+		x_error_caught = false;
+		const auto prev_pixmap_handler = XSetErrorHandler(trapErrorHandler);
+
+		const Pixmap pixmap = XCompositeNameWindowPixmap(dsp, toplevel);
+		XSync(dsp, False);
+
+		XSetErrorHandler(prev_pixmap_handler);
+
+		if (!x_error_caught)
+		{
+			Output &o = outputs.back();
+
+			active_pixmap = pixmap;
+			o.src   = pixmap;
+			o.src_x = x0 - attr.x;
+			o.src_y = y0 - attr.y;
+		}
+	}
+
+	LOGD << "Capturing active window 0x" << std::hex << active << std::dec << (active_pixmap ? " (composite)" : "");
+
+	return true;
+}
+
+/**
+ * Follows moves, resizes and unmaps of the captured window on the event connection.
+ * Returns false if the window was destroyed before it could be followed.
+ */
+bool X11::trackToplevel(Window toplevel)
+{
+	if (toplevel == active_toplevel) return true;
+
+	x_error_caught = false;
+	const auto prev_handler = XSetErrorHandler(trapErrorHandler);
+
+	// The previous window may be gone already, which is fine
+	if (active_toplevel)
+	{
+		XSelectInput(ev_dsp, active_toplevel, NoEventMask);
+		XSync(ev_dsp, False);
+		x_error_caught = false;
+	}
+
+	if (toplevel)
+	{
+		XSelectInput(ev_dsp, toplevel, StructureNotifyMask);
+		XSync(ev_dsp, False);
+	}
+
+	XSetErrorHandler(prev_handler);
+
+	active_toplevel = x_error_caught ? 0 : toplevel;
+
+	return !x_error_caught;
+}
+
+void X11::setCaptureWindow(bool enable)
+{
+	if (enable == capture_window) return;
+
+	if (enable && !use_damage)
+	{
+		LOGW << "Active window capture needs XDamage events. Capturing outputs";
+		return;
+	}
+
+	capture_window = enable;
+
+	if (!enable) trackToplevel(0);
+
+	// Focus changes are reported as property changes on the root window
+	XSelectInput(ev_dsp, DefaultRootWindow(ev_dsp), enable ? PropertyChangeMask : NoEventMask);
+	XFlush(ev_dsp);
+
+	planOutputs();
+}
+
+size_t X11::getOutputCount() const
+{
+	return outputs.size();
+}
+
+Rect X11::getOutputRect(size_t out) const
+{
+	return outputs[out].rect;
+}
+
+// 0 when the output isn't a single CRTC
+RRCrtc X11::getOutputCrtc(size_t out) const
+{
+	return outputs[out].crtc;
+}
+
+void X11::initRender()
+{
+	int ev_base, err_base;
+
+	if (!XRenderQueryExtension(dsp, &ev_base, &err_base))
+	{
+		LOGW << "XRender unavailable. Capturing at full resolution";
+		return;
+	}
+
+	XWindowAttributes attr;
+	XGetWindowAttributes(dsp, root, &attr);
+
+	XRenderPictFormat *fmt = XRenderFindVisualFormat(dsp, attr.visual);
+
+	if (!fmt)
+	{
+		LOGW << "No XRender format for the root visual. Capturing at full resolution";
+		return;
+	}
+
+	XRenderPictureAttributes pa {};
+	pa.subwindow_mode = IncludeInferiors;
+
+	root_pic     = XRenderCreatePicture(dsp, root, fmt, CPSubwindowMode, &pa);
+	thumb_pixmap = XCreatePixmap(dsp, root, thumb_w, thumb_h, unsigned(attr.depth));
+	thumb_pic    = XRenderCreatePicture(dsp, thumb_pixmap, fmt, 0, nullptr);
+
+	// The thumbnail is fetched into the same client buffer every time
+	thumb_img = XCreateImage(dsp, attr.visual, unsigned(attr.depth), ZPixmap, 0, nullptr, thumb_w, thumb_h, 32, 0);
+
+	if (!thumb_img)
+	{
+		LOGW << "Failed to create thumbnail image. Capturing at full resolution";
+		freeRender();
+		return;
+	}
+
+	thumb_buf.resize(size_t(thumb_img->bytes_per_line) * thumb_h);
+	thumb_img->data = reinterpret_cast<char*>(thumb_buf.data());
+
+	thumb_damage.assign(1, Rect{0, 0, thumb_w, thumb_h});
+
+	use_render = true;
+
+	LOGD << "XRender thumbnail capture available (" << thumb_w << '*' << thumb_h << ')';
+}
+
+/**
+ * Points the root picture's transform and filter at an output.
+ * Only sent again when a different output is captured.
+ */
+void X11::setThumbnailSource(size_t out)
+{
+	if (thumb_output == out) return;
+
+	const Rect &r = outputs[out].rect;
+
+	// Map the output onto the thumbnail
+	const double sx = double(r.w) / thumb_w;
+	const double sy = double(r.h) / thumb_h;
+
+	XTransform xform {{
+		{ XDoubleToFixed(sx), 0, XDoubleToFixed(r.x) },
+		{ 0, XDoubleToFixed(sy), XDoubleToFixed(r.y) },
+		{ 0, 0, XDoubleToFixed(1) }
+	}};
+
+	XRenderSetPictureTransform(dsp, root_pic, &xform);
+
+	// Box filter: each thumbnail pixel averages the block of screen pixels it covers
+	const int kw = std::max(int(std::ceil(sx)), 1);
+	const int kh = std::max(int(std::ceil(sy)), 1);
+
+	const size_t taps = size_t(kw) * size_t(kh);
+
+	std::vector<XFixed> kernel(2 + taps);
+	kernel[0] = XDoubleToFixed(kw);
+	kernel[1] = XDoubleToFixed(kh);
+
+	// 1/taps truncated to 16.16 would sum to less than 1.0 and darken the thumbnail.
+	// The remainder is spread evenly over the taps, so the weights add up to exactly 1.0
+	const size_t one = size_t(XDoubleToFixed(1));
+
+	for (size_t i = 0; i < taps; ++i) kernel[2 + i] = XFixed((i + 1) * one / taps - i * one / taps);
+
+	XRenderSetPictureFilter(dsp, root_pic, FilterConvolution, kernel.data(), int(kernel.size()));
+
+	thumb_output = out;
+}
+
+void X11::freeRender()
+{
+	if (thumb_img)
+	{
+		thumb_img->data = nullptr;
+		XDestroyImage(thumb_img);
+		thumb_img = nullptr;
+	}
+
+	if (thumb_pic)    XRenderFreePicture(dsp, thumb_pic);
+	if (thumb_pixmap) XFreePixmap(dsp, thumb_pixmap);
+	if (root_pic)     XRenderFreePicture(dsp, root_pic);
+
+	thumb_pic = root_pic = 0;
+	thumb_pixmap = 0;
+	thumb_output = SIZE_MAX;
+	use_render = false;
+}
+
+bool X11::initStrips()
+{
+	if (!shm_available)
+	{
+		LOGW << "Strip capture needs MIT-SHM. Capturing full frames";
+		return false;
+	}
+
+	const unsigned prev_w = strip_w;
+
+	strip_w = 0;
+
+	for (const auto &o : outputs) strip_w = std::max(strip_w, o.rect.w);
+
+	// Kept across replans while the widest output still fits
+	for (auto &s : strips)
+	{
+		if (!fitShmImage(s, strip_w, strip_h, shm_pixmaps))
+		{
+			freeStrips();
+			return false;
+		}
+	}
+
+	if (!strip_gc)
+	{
+		XGCValues gcv;
+		gcv.subwindow_mode = IncludeInferiors;
+
+		// Otherwise every copy sends a NoExpose event, and nothing reads them off dsp
+		gcv.graphics_exposures = False;
+
+		strip_gc = XCreateGC(dsp, root, GCSubwindowMode | GCGraphicsExposures, &gcv);
+	}
+
+	if (strip_w != prev_w)
+	{
+		LOGD << "Strip capture enabled (" << strip_w << '*' << strip_h << (shm_pixmaps ? ", pipelined" : "") << ')';
+	}
+
+	return true;
+}
+
+void X11::freeStrips()
+{
+	for (auto &s : strips) destroyShmImage(s);
+
+	strip_w = 0;
+
+	if (strip_gc)
+	{
+		XFreeGC(dsp, strip_gc);
+		strip_gc = nullptr;
+	}
+}
+
+void X11::setCaptureMode(CaptureMode mode)
+{
+	if (mode == THUMBNAIL && !use_render)
+	{
+		if (!root_pic) initRender();
+
+		if (!use_render) mode = FULL;
+	}
+
+	// The XCB backend always streams full-resolution captures
+	if (mode == FULL && backend == XCB) mode = STRIPS;
+
+	if (mode == STRIPS && backend == XLIB)
+	{
+		if (!initStrips()) mode = FULL;
+	}
+
+	// Only full captures need output-sized segments
+	for (auto &o : outputs)
+	{
+		if (mode == FULL)
+		{
+			if (shm_available) fitShmImage(o.shm, o.rect.w, o.rect.h, false);
+		}
+		else destroyShmImage(o.shm);
+	}
+
+	if (mode != STRIPS || backend == XCB) freeStrips();
+
+	capture_mode = mode;
+}
+
+bool X11::initXCB()
+{
+	xcb = xcb_connect(nullptr, nullptr);
+
+	if (xcb_connection_has_error(xcb))
+	{
+		LOGW << "Failed to connect through XCB. Using Xlib";
+		xcb_disconnect(xcb);
+		xcb = nullptr;
+		return false;
+	}
+
+	LOGD << "XCB connection established";
+
+	return true;
+}
+
+void X11::setBackend(Backend b)
+{
+	if (b == XCB && !xcb && !initXCB()) b = XLIB;
+
+	backend = b;
+}
+
+/**
+ * Keeps up to xcb_in_flight GetImage requests queued on the server, and reduces each reply
+ * while the following strips are being transferred.
+ */
+void X11::getXCBStrips(const Output &o, const std::function<void(const Frame &strip, uint32_t y)> &reduce)
+{
+	const Rect &rect = o.rect;
+
+	std::array<xcb_get_image_cookie_t, xcb_in_flight> cookies;
+
+	const size_t n = strip_rows.size();
+
+	const auto request = [&] (size_t i)
+	{
+		const uint32_t y = strip_rows[i];
+
+		cookies[i % xcb_in_flight] = xcb_get_image(xcb, XCB_IMAGE_FORMAT_Z_PIXMAP, xcb_drawable_t(o.src),
+		                                           int16_t(o.src_x), int16_t(o.src_y + int(y)),
+		                                           uint16_t(rect.w), uint16_t(std::min(strip_h, rect.h - y)), ~0u);
+		xcb_flush(xcb);
+	};
+
+	for (size_t i = 0; i < std::min(n, xcb_in_flight); ++i) request(i);
+
+	for (size_t i = 0; i < n; ++i)
 	{
-		int ev_base, err_base;
+		xcb_generic_error_t *err = nullptr;
+		xcb_get_image_reply_t *reply = xcb_get_image_reply(xcb, cookies[i % xcb_in_flight], &err);
+
+		// Refill the pipeline before reducing this reply
+		if (i + xcb_in_flight < n) request(i + xcb_in_flight);
 
-		if (!XF86VidModeQueryExtension(dsp, &ev_base, &err_base))
+		if (!reply)
 		{
-			LOGW << "Failed to query XF86VidMode extension";
+			// Most likely the screen shrank since the outputs were planned
+			LOGE << "xcb_get_image failed (error " << (err ? int(err->error_code) : 0) << "). Planning outputs again";
+			screen_changed = true;
+			free(err);
+			continue;
 		}
 
-		int major_ver, minor_ver;
+		const uint32_t y    = strip_rows[i];
+		const uint32_t rows = std::min(strip_h, rect.h - y);
+		const auto stride   = uint32_t(xcb_get_image_data_length(reply)) / rows;
+
+		reduce({ xcb_get_image_data(reply), rect.w, rows, stride, pixel_format, &o.damage }, y);
+
+		free(reply);
+	}
+}
+
+/**
+ * Fetches the damaged part of an output one strip at a time, handing each one to reduce().
+ * With shared pixmaps, the copy of the next strip is queued before the current one is reduced,
+ * so the transfer overlaps the reduction. Only two strips are held in memory at any time.
+ */
+void X11::getX11Strips(size_t out, const std::function<void(const Frame &strip, uint32_t y)> &reduce)
+{
+	const Output &o = outputs[out];
+	const Rect &rect = o.rect;
+	const std::vector<Rect> &damage = o.damage;
+
+	strip_rows.clear();
 
-		if (!XF86VidModeQueryVersion(dsp, &major_ver, &minor_ver))
+	for (uint32_t y = 0; y < rect.h; y += strip_h)
+	{
+		const bool hit = std::any_of(damage.begin(), damage.end(), [&] (const Rect &r)
 		{
-			LOGW << "Failed to query XF86VidMode version";
-		}
+			return r.y < y + strip_h && r.y + r.h > y;
+		});
+
+		if (hit) strip_rows.push_back(y);
+	}
+
+	if (strip_rows.empty()) return;
 
-		LOGD << "XF86VidMode ver: " << major_ver << '.' << minor_ver;
+	if (backend == XCB)
+	{
+		getXCBStrips(o, reduce);
+		return;
 	}
 
-	// Get initial gamma ramp and size
+	const auto request = [&] (ShmImage &s, uint32_t y)
 	{
-		if (!XF86VidModeGetGammaRampSize(dsp, scr_num, &ramp_sz))
+		const unsigned rows = std::min(strip_h, rect.h - y);
+
+		if (s.pixmap)
 		{
-			LOGF << "Failed to get XF86 gamma ramp size";
-			exit(EXIT_FAILURE);
+			XCopyArea(dsp, o.src, s.pixmap, strip_gc, o.src_x, o.src_y + int(y), rect.w, rows, 0, 0);
+			XFlush(dsp);
 		}
+		else
+		{
+			// The server packs the rows by the requested width
+			s.img->width  = int(rect.w);
+			s.img->height = int(rows);
+			s.img->bytes_per_line = (int(rect.w) * s.img->bits_per_pixel + 31) / 32 * 4;
+			XShmGetImage(dsp, o.src, s.img, o.src_x, o.src_y + int(y), AllPlanes);
+		}
+	};
+
+	// The outputs are from the last plan. If the screen shrank since, reading them raises BadMatch
+	x_error_caught = false;
+	const auto prev_handler = XSetErrorHandler(trapErrorHandler);
+
+	request(strips[0], strip_rows[0]);
+
+	size_t cur = 0;
+
+	for (size_t i = 0; i < strip_rows.size(); ++i)
+	{
+		const ShmImage &s = strips[cur];
+		const uint32_t y  = strip_rows[i];
+
+		// Wait for the queued copy to land in the segment
+		if (s.pixmap) XSync(dsp, False);
+
+		if (x_error_caught) break;
+
+		if (i + 1 < strip_rows.size()) request(strips[cur ^ 1], strip_rows[i + 1]);
+
+		reduce({ reinterpret_cast<uint8_t*>(s.img->data), rect.w, std::min(strip_h, rect.h - y), uint32_t(s.img->bytes_per_line), pixel_format, &damage }, y);
+
+		cur ^= 1;
+	}
+
+	// Drains the copy still queued if the loop stopped early
+	XSync(dsp, False);
+	XSetErrorHandler(prev_handler);
+
+	if (x_error_caught)
+	{
+		LOGE << "Strip capture of output " << out << " failed. Planning outputs again";
+		screen_changed = true;
+	}
+}
+
+// Whether damage events narrow down what changed. Without them, every capture is full
+bool X11::hasDamage() const
+{
+	return use_damage;
+}
+
+/**
+ * Pointer position in root window coordinates. One round trip, so it's queried once per capture.
+ */
+bool X11::getPointer(int &x, int &y)
+{
+	Window root_ret, child;
+	int win_x, win_y;
+	unsigned mask;
+
+	return XQueryPointer(dsp, root, &root_ret, &child, &x, &y, &win_x, &win_y, &mask);
+}
+
+/**
+ * Refresh rate of the fastest active CRTC, from its mode timings. 0 if unknown.
+ */
+double X11::getRefreshRate()
+{
+	if (!use_randr) return 0;
+
+	XRRScreenResources *res = XRRGetScreenResourcesCurrent(dsp, root);
 
-		if(ramp_sz == 0)
+	double hz = 0;
+
+	for (int i = 0; res && i < res->ncrtc; ++i)
+	{
+		XRRCrtcInfo *info = XRRGetCrtcInfo(dsp, res, res->crtcs[i]);
+
+		if (!info) continue;
+
+		for (int j = 0; info->mode != None && j < res->nmode; ++j)
 		{
-			LOGF << "Invalid gamma ramp size";
-			exit(EXIT_FAILURE);
+			const XRRModeInfo &mode = res->modes[j];
+
+			if (mode.id != info->mode || !mode.hTotal || !mode.vTotal) continue;
+
+			hz = std::max(hz, double(mode.dotClock) / (double(mode.hTotal) * mode.vTotal));
 		}
 
-		init_ramp.resize(3 * size_t(ramp_sz) * sizeof(uint16_t));
+		XRRFreeCrtcInfo(info);
+	}
+
+	if (res) XRRFreeScreenResources(res);
+
+	return hz;
+}
+
+/**
+ * Regions of an output damaged before the last successful waitForDamage call, relative to the output.
+ */
+const std::vector<Rect>& X11::getDamage(size_t out) const
+{
+	return outputs[out].damage;
+}
+
+/**
+ * Captures an output in the current mode. The outputs are from the last plan: if the screen shrank since,
+ * reading them raises BadMatch. That error is trapped, and the outputs are planned again on the next wait.
+ */
+Frame X11::getX11Snapshot(size_t out) noexcept
+{
+	x_error_caught = false;
+	const auto prev_handler = XSetErrorHandler(trapErrorHandler);
+
+	// All the capture requests are round trips, so any error has arrived by now
+	const Frame frame = captureOutput(out);
+
+	XSetErrorHandler(prev_handler);
+
+	if (x_error_caught)
+	{
+		LOGE << "Capture of output " << out << " failed. Planning outputs again";
+		screen_changed = true;
+
+		return { nullptr, 0, 0, 0, pixel_format, &outputs[out].damage };
+	}
+
+	return frame;
+}
+
+Frame X11::captureOutput(size_t out)
+{
+	Output &o = outputs[out];
+
+	if (last_img)
+	{
+		XDestroyImage(last_img);
+		last_img = nullptr;
+	}
 
-		uint16_t *d = init_ramp.data(),
-			 *r = &d[0 * ramp_sz],
-			 *g = &d[1 * ramp_sz],
-			 *b = &d[2 * ramp_sz];
+	if (capture_mode == THUMBNAIL)
+	{
+		setThumbnailSource(out);
+
+		// Only the downscaled pixels cross the connection
+		XRenderComposite(dsp, PictOpSrc, root_pic, None, thumb_pic, 0, 0, 0, 0, 0, 0, thumb_w, thumb_h);
+		XGetSubImage(dsp, thumb_pixmap, 0, 0, thumb_w, thumb_h, AllPlanes, ZPixmap, thumb_img, 0, 0);
+
+		return { thumb_buf.data(), thumb_w, thumb_h, uint32_t(thumb_img->bytes_per_line), pixel_format, &thumb_damage };
+	}
 
-		if (!XF86VidModeGetGammaRamp(dsp, scr_num, ramp_sz, r, g, b))
+	if (o.shm.img)
+	{
+		// The server writes straight into the segment, so the pixels are read in place
+		if (XShmGetImage(dsp, o.src, o.shm.img, o.src_x, o.src_y, AllPlanes))
 		{
-			LOGE << "Failed to get initial gamma ramp";
-			initial_ramp_exists = false;
+			return { reinterpret_cast<uint8_t*>(o.shm.img->data), o.rect.w, o.rect.h, uint32_t(o.shm.img->bytes_per_line), pixel_format, &o.damage };
 		}
+
+		// A stale rect, not a problem with the segment
+		if (x_error_caught) return {};
+
+		LOGE << "XShmGetImage failed. Falling back to XGetImage";
+		destroyShmImage(o.shm);
+	}
+
+	// Kept until the next capture, so the reduction reads Xlib's buffer without copying it
+	last_img = XGetImage(dsp, o.src, o.src_x, o.src_y, o.rect.w, o.rect.h, AllPlanes, ZPixmap);
+
+	if (!last_img)
+	{
+		LOGE << "XGetImage failed";
+		return { nullptr, 0, 0, 0, pixel_format, &o.damage };
+	}
+
+	return { reinterpret_cast<uint8_t*>(last_img->data), o.rect.w, o.rect.h, uint32_t(last_img->bytes_per_line), pixel_format, &o.damage };
+}
+
+/**
+ * Subscribes to Present CompleteNotify events on the root window, so gamma updates can be timed
+ * to every divisor-th vblank. Returns false if the extension is unavailable.
+ */
+bool X11::initPresent(unsigned divisor)
+{
+	present_xcb = xcb_connect(nullptr, nullptr);
+
+	if (xcb_connection_has_error(present_xcb))
+	{
+		LOGW << "Failed to connect through XCB. Gamma updates won't follow vblank";
+		freePresent();
+		return false;
+	}
+
+	const xcb_query_extension_reply_t *ext = xcb_get_extension_data(present_xcb, &xcb_present_id);
+
+	xcb_present_query_version_reply_t *ver = nullptr;
+
+	if (ext && ext->present)
+	{
+		ver = xcb_present_query_version_reply(present_xcb, xcb_present_query_version(present_xcb, 1, 0), nullptr);
+	}
+
+	if (!ver)
+	{
+		LOGW << "Present extension unavailable. Gamma updates won't follow vblank";
+		freePresent();
+		return false;
+	}
+
+	LOGD << "Present ver: " << ver->major_version << '.' << ver->minor_version;
+
+	free(ver);
+
+	const xcb_window_t win = xcb_setup_roots_iterator(xcb_get_setup(present_xcb)).data->root;
+
+	present_eid = xcb_generate_id(present_xcb);
+	present_ev  = xcb_register_for_special_xge(present_xcb, &xcb_present_id, present_eid, nullptr);
+
+	xcb_generic_error_t *err = xcb_request_check(present_xcb,
+	        xcb_present_select_input_checked(present_xcb, present_eid, win, XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY));
+
+	if (err)
+	{
+		LOGW << "Present SelectInput failed (" << int(err->error_code) << "). Gamma updates won't follow vblank";
+		free(err);
+		freePresent();
+		return false;
 	}
+
+	present_divisor = std::max(divisor, 1u);
+
+	LOGI << "Gamma updates aligned to every " << present_divisor << " vblank(s)";
+
+	return true;
 }
 
-void X11::getX11Snapshot(std::vector<uint8_t> &buf) noexcept
+/**
+ * Blocks until the next vblank whose MSC is a multiple of the divisor.
+ * Returns false on timeout, or if Present isn't in use.
+ */
+bool X11::waitForVblank(int timeout_ms)
 {
-	const auto img = XGetImage(dsp, root, 0, 0, w, h, AllPlanes, ZPixmap);
+	if (!present_ev) return false;
+
+	const xcb_window_t win = xcb_setup_roots_iterator(xcb_get_setup(present_xcb)).data->root;
+	const uint32_t serial  = ++present_serial;
+
+	// With a target of 0, the MSC already passed, so the event comes at the next MSC % divisor == 0
+	xcb_present_notify_msc(present_xcb, win, serial, 0, present_divisor, 0);
+	xcb_flush(present_xcb);
+
+	using namespace std::chrono;
+
+	const auto deadline = steady_clock::now() + milliseconds(timeout_ms);
+
+	while (true)
+	{
+		while (xcb_generic_event_t *ev = xcb_poll_for_special_event(present_xcb, present_ev))
+		{
+			const auto *cn = reinterpret_cast<xcb_present_complete_notify_event_t*>(ev);
+
+			const bool ours = cn->event_type == XCB_PRESENT_COMPLETE_NOTIFY
+			               && cn->kind == XCB_PRESENT_COMPLETE_KIND_NOTIFY_MSC
+			               && cn->serial == serial;
+
+			free(ev);
+
+			if (ours) return true;
+		}
+
+		const auto left = duration_cast<milliseconds>(deadline - steady_clock::now()).count();
+
+		if (left <= 0 || xcb_connection_has_error(present_xcb)) return false;
+
+		pollfd pfd { xcb_get_file_descriptor(present_xcb), POLLIN, 0 };
+
+		poll(&pfd, 1, int(left));
+	}
+}
 
-	memcpy(buf.data(), reinterpret_cast<uint8_t*>(img->data), buf.size());
+void X11::freePresent()
+{
+	if (present_ev) xcb_unregister_for_special_event(present_xcb, present_ev);
+	if (present_xcb) xcb_disconnect(present_xcb);
 
-	img->f.destroy_image(img);
+	present_ev  = nullptr;
+	present_xcb = nullptr;
 }
 
-void X11::fillRamp(std::vector<uint16_t> &ramp, const int brightness, const int temp_step)
+void X11::fillRamp(std::vector<uint16_t> &ramp, const int size, const int brightness, const int temp_step)
 {
-	auto r = &ramp[0 * ramp_sz],
-	     g = &ramp[1 * ramp_sz],
-	     b = &ramp[2 * ramp_sz];
+	auto r = &ramp[0 * size_t(size)],
+	     g = &ramp[1 * size_t(size)],
+	     b = &ramp[2 * size_t(size)];
 
 	std::array<double, 3> c{1.0, 1.0, 1.0};
 
 	setColors(temp_step, c);
 
-	/* This equals 32 when ramp_sz = 2048, 64 when 1024, etc.
-	*  Assuming ramp_sz = 2048 and pure state (default brightness/temp)
+	/* This equals 32 when size = 2048, 64 when 1024, etc.
+	*  Assuming size = 2048 and pure state (default brightness/temp)
 	*  each color channel looks like:
 	* { 0, 32, 64, 96, ... UINT16_MAX - 32 } */
-	const int ramp_mult = (UINT16_MAX + 1) / ramp_sz;
+	const int ramp_mult = (UINT16_MAX + 1) / size;
 
-	for (int32_t i = 0; i < ramp_sz; ++i)
+	for (int32_t i = 0; i < size; ++i)
 	{
 		const int val = clamp(int(normalize(0, brt_slider_steps, brightness) * ramp_mult * i), 0, UINT16_MAX);
 
@@ -116,27 +1411,206 @@ void X11::fillRamp(std::vector<uint16_t> &ramp, const int brightness, const int
 	}
 }
 
-void X11::setXF86Gamma(int scr_br, int temp)
+/**
+ * Returns the ramp for a size, brightness and temperature step, computing it only on a cache miss.
+ * Once the cache is full, the oldest slot is overwritten in place, so nothing is allocated.
+ */
+const std::vector<uint16_t>& X11::getRamp(int size, int brightness, int temp)
 {
-	std::vector<uint16_t> r (3 * ramp_sz * sizeof(uint16_t));
+	const RampKey key { size, brightness, temp };
+
+	// A linear scan over a few dozen keys costs less than hashing, and never allocates
+	const auto it = std::find(ramp_keys.begin(), ramp_keys.end(), key);
+
+	if (it != ramp_keys.end()) return ramp_cache[size_t(it - ramp_keys.begin())];
+
+	const size_t slot = ramp_next;
+	ramp_next = (ramp_next + 1) % ramp_cache_sz;
 
-	fillRamp(r, scr_br, temp);
+	if (slot == ramp_cache.size())
+	{
+		ramp_cache.emplace_back();
+		ramp_keys.push_back(key);
+	}
+
+	// Only grows when CRTCs with different ramp sizes share the cache
+	ramp_cache[slot].resize(3 * size_t(size));
+
+	fillRamp(ramp_cache[slot], size, brightness, temp);
+	ramp_keys[slot] = key;
 
-	XF86VidModeSetGammaRamp(dsp, 0, ramp_sz, &r[0*ramp_sz], &r[1*ramp_sz], &r[2*ramp_sz]);
+	return ramp_cache[slot];
 }
 
-void X11::setInitialGamma(bool set_previous)
+/**
+ * Lists the CRTCs whose gamma can be set through XRandR, each with its own ramp size.
+ * Without XRandR, the whole screen is one XF86VidMode ramp.
+ * Called again after layout changes: known CRTCs keep their initial ramp. Nothing is written here,
+ * the gamma thread is asked to send its current state to every CRTC instead.
+ */
+void X11::initGamma()
+{
+	std::unique_lock<std::mutex> lock(gamma_mtx);
+
+	std::vector<GammaCrtc> old;
+	old.swap(gamma_crtcs);
+
+	XRRScreenResources *res = use_randr ? XRRGetScreenResourcesCurrent(dsp, root) : nullptr;
+
+	for (int i = 0; res && i < res->ncrtc; ++i)
+	{
+		const RRCrtc id = res->crtcs[i];
+
+		XRRCrtcInfo *info = XRRGetCrtcInfo(dsp, res, id);
+
+		const bool active = info && info->mode != None;
+
+		if (info) XRRFreeCrtcInfo(info);
+
+		const int sz = active ? XRRGetCrtcGammaSize(dsp, id) : 0;
+
+		if (sz <= 0) continue;
+
+		const auto known = std::find_if(old.begin(), old.end(), [id, sz] (const GammaCrtc &c) { return c.crtc == id && c.ramp_sz == sz; });
+
+		if (known != old.end())
+		{
+			gamma_crtcs.push_back(std::move(*known));
+			continue;
+		}
+
+		GammaCrtc c;
+		c.crtc    = id;
+		c.ramp_sz = sz;
+
+		if (XRRCrtcGamma *g = XRRGetCrtcGamma(dsp, id))
+		{
+			c.init_ramp.resize(3 * size_t(sz));
+
+			std::copy(g->red,   g->red   + sz, &c.init_ramp[0 * size_t(sz)]);
+			std::copy(g->green, g->green + sz, &c.init_ramp[1 * size_t(sz)]);
+			std::copy(g->blue,  g->blue  + sz, &c.init_ramp[2 * size_t(sz)]);
+
+			XRRFreeGamma(g);
+		}
+		else LOGE << "Failed to get initial gamma ramp of CRTC " << id;
+
+		gamma_crtcs.push_back(std::move(c));
+	}
+
+	if (res) XRRFreeScreenResources(res);
+
+	if (gamma_crtcs.empty() && initXF86Gamma())
+	{
+		GammaCrtc c;
+		c.ramp_sz = ramp_sz;
+
+		if (initial_ramp_exists) c.init_ramp = init_ramp;
+
+		gamma_crtcs.push_back(std::move(c));
+
+		LOGD << "Gamma set through XF86VidMode";
+	}
+	else if (gamma_crtcs.empty()) LOGE << "No way to set gamma";
+	else LOGD << "Gamma set through XRandR on " << gamma_crtcs.size() << " CRTC(s)";
+
+	// A mode change may have reset the hardware ramps, and new CRTCs have none of ours yet
+	for (auto &c : gamma_crtcs) c.applied.clear();
+
+	lock.unlock();
+
+	if (gamma_reset) gamma_reset();
+}
+
+void X11::setGammaReset(std::function<void()> fn)
+{
+	gamma_reset = std::move(fn);
+}
+
+/**
+ * Queues a ramp on a CRTC, or sets the XF86VidMode ramp of the screen.
+ * Expects gamma_mtx to be held. XRandR writes are only sent on the next flush.
+ */
+void X11::applyRamp(GammaCrtc &c, const std::vector<uint16_t> &ramp)
 {
-	if(set_previous && initial_ramp_exists)
+	// Neighbouring slider steps often quantize to the same ramp, especially with small ramp sizes
+	if (ramp == c.applied)
 	{
-		LOGI << "Setting previous gamma";
-		XF86VidModeSetGammaRamp(dsp, scr_num, ramp_sz, &init_ramp[0*ramp_sz], &init_ramp[1*ramp_sz], &init_ramp[2*ramp_sz]);
+		++gamma_skipped;
+		return;
 	}
-	else
+
+	// Both APIs take non-const pointers, but only read them
+	auto *d = const_cast<uint16_t*>(ramp.data());
+
+	const auto n = size_t(c.ramp_sz);
+
+	if (c.crtc)
+	{
+		// Points at the cached ramp, instead of copying it into an XRRAllocGamma buffer
+		XRRCrtcGamma g { c.ramp_sz, &d[0*n], &d[1*n], &d[2*n] };
+
+		XRRSetCrtcGamma(dsp, c.crtc, &g);
+	}
+	else XF86VidModeSetGammaRamp(dsp, scr_num, c.ramp_sz, &d[0*n], &d[1*n], &d[2*n]);
+
+	// Same size every time, so this copies without reallocating after the first write
+	c.applied = ramp;
+	++gamma_issued;
+}
+
+/**
+ * Sets every CRTC to the same ramp, with one flush for all of them.
+ * CRTCs listed in crtc_br get their own brightness step instead. Ones that went away are ignored.
+ */
+void X11::setXF86Gamma(int scr_br, int temp, const std::vector<std::pair<uint64_t, int>> &crtc_br)
+{
+	std::lock_guard<std::mutex> lock(gamma_mtx);
+
+	for (auto &c : gamma_crtcs)
+	{
+		const auto own = std::find_if(crtc_br.begin(), crtc_br.end(), [&c] (const std::pair<uint64_t, int> &p) { return c.crtc && p.first == c.crtc; });
+
+		applyRamp(c, getRamp(c.ramp_sz, own != crtc_br.end() ? own->second : scr_br, temp));
+	}
+
+	XFlush(dsp);
+}
+
+void X11::setInitialGamma(bool set_previous)
+{
 	{
-		LOGI << "Setting pure gamma";
-		X11::setXF86Gamma(brt_slider_steps, 0);
+		std::lock_guard<std::mutex> lock(gamma_mtx);
+
+		for (auto &c : gamma_crtcs)
+		{
+			if (set_previous && !c.init_ramp.empty())
+			{
+				LOGI << "Setting previous gamma";
+				applyRamp(c, c.init_ramp);
+			}
+			else
+			{
+				LOGI << "Setting pure gamma";
+				applyRamp(c, getRamp(c.ramp_sz, brt_slider_steps, 0));
+			}
+		}
+
+		XFlush(dsp);
 	}
+
+	uint64_t issued, skipped;
+	getGammaStats(issued, skipped);
+
+	LOGD << "Gamma writes issued: " << issued << ", skipped: " << skipped;
+}
+
+void X11::getGammaStats(uint64_t &issued, uint64_t &skipped)
+{
+	std::lock_guard<std::mutex> lock(gamma_mtx);
+
+	issued  = gamma_issued;
+	skipped = gamma_skipped;
 }
 
 uint32_t X11::getWidth()
@@ -151,5 +1625,27 @@ uint32_t X11::getHeight()
 
 X11::~X11()
 {
+	if(xcb) xcb_disconnect(xcb);
+
+	freePresent();
+
+	for (auto &o : outputs) destroyShmImage(o.shm);
+
+	if (active_pixmap) XFreePixmap(dsp, active_pixmap);
+	if (last_img)      XDestroyImage(last_img);
+
+	freeStrips();
+	freeRender();
+
+	if(ev_dsp)
+	{
+		if(use_damage)
+		{
+			XFixesDestroyRegion(ev_dsp, damage_region);
+			XDamageDestroy(ev_dsp, damage);
+		}
+		XCloseDisplay(ev_dsp);
+	}
+
 	if(dsp) XCloseDisplay(dsp);
 }
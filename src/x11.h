@@ -7,8 +7,20 @@
 #define X11_H
 
 #include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xrender.h>
+#include <X11/extensions/Xrandr.h>
+#include <X11/extensions/Xcomposite.h>
+#include <xcb/xcb.h>
+#include <xcb/present.h>
+#include <array>
 #include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
 #include <vector>
+#include "utils.h"
 
 class X11
 {
@@ -17,7 +29,8 @@ class X11
 	Screen *scr;
 	Window root;
 
-	int ramp_sz;
+	// XF86VidMode ramp of the screen, only read when XRandR can't set gamma
+	int ramp_sz = 0;
 	int scr_num;
 
 	std::vector<uint16_t> init_ramp;
@@ -25,17 +38,213 @@ class X11
 
 	unsigned w, h;
 
-	void fillRamp(std::vector<uint16_t> &ramp, const int brightness, const int temp);
+	// Layout of captured pixels, detected once from the default visual
+	PixelFormat pixel_format = BGRX32;
+	void initPixelFormat();
+
+	// Image returned by the last XGetImage, read in place until the next capture
+	XImage *last_img = nullptr;
+
+	// Image backed by a MIT-SHM segment the server writes into
+	struct ShmImage
+	{
+		XShmSegmentInfo info {};
+		XImage *img   = nullptr;
+		Pixmap pixmap = 0;
+		size_t size   = 0;
+	};
+
+	bool shm_available = false;
+	bool shm_pixmaps   = false;
+
+	void initShm();
+	bool createShmImage(ShmImage &s, unsigned width, unsigned height, bool with_pixmap);
+	void destroyShmImage(ShmImage &s);
+	bool fitShmImage(ShmImage &s, unsigned width, unsigned height, bool with_pixmap);
+
+	// Captured and reduced independently: one per active CRTC, or the whole root window
+	struct Output
+	{
+		Rect rect;
+		RRCrtc crtc = 0;
+
+		// Where the pixels are read from: the root window, or a window's composite pixmap
+		Drawable src = 0;
+		int src_x = 0, src_y = 0;
+
+		ShmImage shm;
+		std::vector<Rect> damage;
+	};
+
+	std::vector<Output> outputs;
+	bool use_randr  = false;
+	bool per_output = false;
+
+	// Set when the screen size or the CRTC layout changed
+	int  randr_ev_base  = 0;
+	bool screen_changed = false;
+
+	void initRandr();
+	void updateScreenSize();
+	void planOutputs();
+	void addOutput(const Rect &rect, RRCrtc crtc);
+
+	// Active window tracking through _NET_ACTIVE_WINDOW
+	Atom net_active_window = 0;
+	Window active_toplevel = 0;
+	Pixmap active_pixmap   = 0;
+	bool use_composite     = false;
+	bool capture_window    = false;
+	bool window_changed    = false;
+
+	bool planActiveWindow();
+	bool trackToplevel(Window toplevel);
+
+	Frame captureOutput(size_t out);
+
+	// Separate connection for damage events, only read by the capture thread
+	Display *ev_dsp = nullptr;
+	Damage damage = 0;
+	XserverRegion damage_region = 0;
+	std::vector<Rect> damage_rects;
+	int damage_ev_base = 0;
+	bool use_damage  = false;
+	bool damaged     = true;
+	bool full_damage = true;
+
+	void initDamage();
+	void processEvents();
+
+	// Server-side downscaling of the root window
+	static constexpr unsigned thumb_w = 128;
+	static constexpr unsigned thumb_h = 72;
+
+	Picture root_pic  = 0;
+	Picture thumb_pic = 0;
+	Pixmap  thumb_pixmap = 0;
+	XImage *thumb_img = nullptr;
+	std::vector<uint8_t> thumb_buf;
+	std::vector<Rect> thumb_damage;
+	size_t thumb_output = SIZE_MAX;
+	bool use_render = false;
+
+	void setThumbnailSource(size_t out);
+
+	void initRender();
+	void freeRender();
+
+	// Double-buffered strips for streaming capture
+	std::array<ShmImage, 2> strips;
+	std::vector<uint32_t> strip_rows;
+	unsigned strip_w = 0;
+	GC strip_gc = nullptr;
+
+	bool initStrips();
+	void freeStrips();
+
+	// Own XCB connection, so GetImage requests can be kept in flight while reducing
+	static constexpr size_t xcb_in_flight = 3;
+	xcb_connection_t *xcb = nullptr;
+
+	bool initXCB();
+	void getXCBStrips(const Output &o, const std::function<void(const Frame &strip, uint32_t y)> &reduce);
+
+	void fillRamp(std::vector<uint16_t> &ramp, const int size, const int brightness, const int temp);
+
+	// Ramps computed for recent (size, brightness, temperature) triples. Slots are reused oldest first
+	static constexpr size_t ramp_cache_sz = 64;
+
+	struct RampKey
+	{
+		int size, brightness, temp;
+
+		bool operator==(const RampKey &k) const { return size == k.size && brightness == k.brightness && temp == k.temp; }
+	};
+
+	std::vector<std::vector<uint16_t>> ramp_cache;
+	std::vector<RampKey> ramp_keys;
+	size_t ramp_next = 0;
+
+	const std::vector<uint16_t>& getRamp(int size, int brightness, int temp);
+
+	// Gamma is set per CRTC through XRandR. Without it, crtc is 0 and the screen's XF86VidMode ramp is used
+	struct GammaCrtc
+	{
+		RRCrtc crtc = 0;
+		int ramp_sz = 0;
+
+		std::vector<uint16_t> init_ramp;
+
+		// Last ramp sent to the server. Writes that would not change it are skipped
+		std::vector<uint16_t> applied;
+	};
+
+	// The CRTC list is rebuilt by the capture thread, while the gamma thread writes ramps
+	std::mutex gamma_mtx;
+
+	std::vector<GammaCrtc> gamma_crtcs;
+
+	// Called after the CRTC list changed, so whoever owns the gamma state sends it again
+	std::function<void()> gamma_reset;
+
+	uint64_t gamma_issued  = 0;
+	uint64_t gamma_skipped = 0;
+
+	void initGamma();
+	bool initXF86Gamma();
+	void applyRamp(GammaCrtc &c, const std::vector<uint16_t> &ramp);
+
+	// Vblank notifications through the Present extension, on a connection only the gamma thread uses
+	xcb_connection_t *present_xcb   = nullptr;
+	xcb_special_event_t *present_ev = nullptr;
+	xcb_present_event_t present_eid = 0;
+	uint32_t present_serial  = 0;
+	unsigned present_divisor = 1;
+
+	void freePresent();
 
 	public:
+	enum CaptureMode
+	{
+		FULL, THUMBNAIL, STRIPS
+	} capture_mode = FULL;
+
+	enum Backend
+	{
+		XLIB, XCB
+	} backend = XLIB;
+
+	static constexpr unsigned strip_h = 64;
+
 	X11();
 
 	uint32_t getWidth();
 	uint32_t getHeight();
 
-	void getX11Snapshot(std::vector<uint8_t> &buf) noexcept;
-	void setXF86Gamma(int scrBr, int temp);
+	size_t getOutputCount() const;
+	Rect getOutputRect(size_t out) const;
+	RRCrtc getOutputCrtc(size_t out) const;
+	const std::vector<Rect>& getDamage(size_t out) const;
+
+	PixelFormat getPixelFormat() const;
+	bool getPointer(int &x, int &y);
+	double getRefreshRate();
+	bool hasDamage() const;
+
+	Frame getX11Snapshot(size_t out) noexcept;
+	void getX11Strips(size_t out, const std::function<void(const Frame &strip, uint32_t y)> &reduce);
+	bool waitForDamage(int timeout_ms);
+	void setCaptureMode(CaptureMode mode);
+	void setShm(bool enable);
+	void setBackend(Backend b);
+	void setPerOutput(bool enable);
+	void setCaptureWindow(bool enable);
+	void setXF86Gamma(int scrBr, int temp, const std::vector<std::pair<uint64_t, int>> &crtc_br = {});
+	void setGammaReset(std::function<void()> fn);
 	void setInitialGamma(bool set_previous);
+	bool initPresent(unsigned divisor);
+	bool waitForVblank(int timeout_ms);
+	void getGammaStats(uint64_t &issued, uint64_t &skipped);
 
 	~X11();
 };
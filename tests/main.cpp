@@ -0,0 +1,33 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "test.h"
+
+int failures = 0;
+
+int main()
+{
+	const struct { const char *name; void (*run)(); } tests[] =
+	{
+		{ "tilegrid", testTileGrid },
+		{ "reduce",   testReduce },
+		{ "utils",    testUtils },
+		{ "brfilter", testBrightnessFilter },
+		{ "sampler",  testSampler },
+	};
+
+	for (const auto &t : tests)
+	{
+		const int before = failures;
+
+		t.run();
+
+		std::cout << (failures == before ? "PASS " : "FAIL ") << t.name << '\n';
+	}
+
+	std::cout << failures << " failure(s)\n";
+
+	return failures ? 1 : 0;
+}
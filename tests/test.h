@@ -0,0 +1,38 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <iostream>
+
+extern int failures;
+
+// Reports a failed condition and keeps going, so one run shows every failure
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			++failures; \
+			std::cerr << __FILE__ << ':' << __LINE__ << ": CHECK(" #cond ") failed\n"; \
+		} \
+	} while (0)
+
+#define CHECK_EQ(a, b) \
+	do { \
+		const auto va = (a); \
+		const auto vb = (b); \
+		if (!(va == vb)) { \
+			++failures; \
+			std::cerr << __FILE__ << ':' << __LINE__ << ": CHECK_EQ(" #a ", " #b ") failed: " << va << " != " << vb << '\n'; \
+		} \
+	} while (0)
+
+void testTileGrid();
+void testReduce();
+void testUtils();
+void testBrightnessFilter();
+void testSampler();
+
+#endif // TEST_H
@@ -0,0 +1,139 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "test.h"
+#include "brfilter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+/**
+ * One hour of brightness sampled every 100 ms: a scene change every ten minutes,
+ * with noisy video segments (sigma 8) and scrolling bursts on top of it.
+ */
+static std::vector<int> makeTrace()
+{
+	std::mt19937 rng(19);
+	std::normal_distribution<double> video(0, 8);
+	std::uniform_int_distribution<int> scene(40, 215);
+
+	std::vector<int> trace;
+	trace.reserve(36000);
+
+	int base = scene(rng);
+
+	for (int i = 0; i < 36000; ++i)
+	{
+		if (i % 6000 == 0) base = scene(rng);
+
+		// Within each minute: 20 s of video, 10 s of scrolling, 30 s of still picture
+		const int t = i % 600;
+
+		double v = base;
+
+		if (t < 200)      v += video(rng);
+		else if (t < 300) v += (t / 3) % 2 ? 12 : -12;
+
+		trace.push_back(std::max(0, std::min(255, int(std::lround(v)))));
+	}
+
+	return trace;
+}
+
+/**
+ * Same trigger as the screenshot loop. The first sample is sent unconditionally, as the loop forces it at startup,
+ * and isn't counted. Calls scene_end(i, sent) on the last sample of every ten minute scene.
+ */
+template <typename F>
+static int countTransitions(const std::vector<int> &trace, double tau_ms, int threshold, F scene_end)
+{
+	BrightnessFilter filter;
+
+	int sent = 0, transitions = 0;
+
+	for (size_t i = 0; i < trace.size(); ++i)
+	{
+		const int br = filter.update(trace[i], 100, tau_ms);
+
+		if (i == 0) sent = br;
+		else if (needsTransition(br, trace[i], sent, threshold))
+		{
+			sent = br;
+			++transitions;
+		}
+
+		if (i % 6000 == 5999) scene_end(i, sent);
+	}
+
+	return transitions;
+}
+
+static int countTransitions(const std::vector<int> &trace, double tau_ms, int threshold)
+{
+	return countTransitions(trace, tau_ms, threshold, [] (size_t, int) {});
+}
+
+void testBrightnessFilter()
+{
+	// The first measurement and a zero time constant pass through unchanged
+	{
+		BrightnessFilter f;
+		CHECK_EQ(f.update(200, 100, 1000), 200);
+		CHECK_EQ(f.update(50, 100, 0), 50);
+		CHECK_EQ(f.update(120, 100, 0), 120);
+	}
+
+	// A step is followed smoothly and settles within five time constants
+	{
+		BrightnessFilter f;
+		f.update(0, 100, 1000);
+
+		int prev = 0;
+
+		for (int i = 1; i <= 50; ++i)
+		{
+			const int v = f.update(200, 100, 1000);
+
+			CHECK(v >= prev && v <= 200);
+			prev = v;
+		}
+
+		CHECK(prev >= 198);
+	}
+
+	// A clean step is one transition, however gradually the filter follows it
+	{
+		std::vector<int> step(100, 40);
+		step.resize(400, 200);
+
+		for (const double tau : { 0.0, 500.0, 1000.0, 2000.0 }) CHECK_EQ(countTransitions(step, tau, 36), 1);
+	}
+
+	// Filtering gives fewer transitions on the replayed trace, and never loses a scene change
+	const std::vector<int> trace = makeTrace();
+
+	const double taus[] = { 0, 500, 1000, 2000 };
+
+	int counts[4];
+
+	for (size_t i = 0; i < 4; ++i)
+	{
+		// Every scene ends on a still picture, which the last transition must be within the threshold of
+		counts[i] = countTransitions(trace, taus[i], 36, [&] (size_t end, int sent)
+		{
+			CHECK(std::abs(sent - trace[end]) <= 36);
+		});
+	}
+
+	std::cout << "  transitions per hour (tau 0/500/1000/2000 ms): "
+	          << counts[0] << ' ' << counts[1] << ' ' << counts[2] << ' ' << counts[3] << '\n';
+
+	for (size_t i = 1; i < 4; ++i) CHECK(counts[i] <= counts[0]);
+
+	// The default must cut noise-driven transitions by at least five times
+	CHECK(counts[2] * 5 <= counts[0]);
+}
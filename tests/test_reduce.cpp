@@ -0,0 +1,100 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "test.h"
+#include "reduce.h"
+#include <random>
+
+// Every kernel the CPU runs has to give exactly the sums of its scalar reference
+void testReduce()
+{
+	std::mt19937 rng(42);
+
+	const auto rnd = [&] (uint32_t n) { return uint32_t(rng() % n); };
+
+	std::vector<uint8_t> buf;
+
+	for (const auto &k : sumBGRXKernels())
+	{
+		std::cout << "  kernel: " << k.name << '\n';
+
+		for (int i = 0; i < 2000; ++i)
+		{
+			const uint32_t width  = rnd(300);
+			const uint32_t rows   = 1 + rnd(8);
+			const size_t   stride = size_t(width) * 4 + rnd(64);
+			const size_t   offset = rnd(16); // Unaligned starts
+
+			buf.resize(offset + stride * rows);
+
+			// Saturated input is the worst case for the accumulators
+			if (rnd(4) == 0) std::fill(buf.begin(), buf.end(), 0xff);
+			else for (auto &v : buf) v = uint8_t(rng());
+
+			// Kernels add to what's already in the sums
+			const uint64_t init = rng();
+
+			uint64_t r = init, g = init, b = init;
+			uint64_t er = init, eg = init, eb = init;
+
+			k.sum(buf.data() + offset, width, rows, stride, r, g, b);
+			sumBGRXScalar(buf.data() + offset, width, rows, stride, er, eg, eb);
+
+			CHECK_EQ(r, er);
+			CHECK_EQ(g, eg);
+			CHECK_EQ(b, eb);
+		}
+
+		// A whole saturated 4K frame
+		constexpr uint32_t w = 3840, h = 2160;
+
+		buf.assign(size_t(w) * h * 4, 0xff);
+
+		uint64_t r = 0, g = 0, b = 0;
+		k.sum(buf.data(), w, h, size_t(w) * 4, r, g, b);
+
+		CHECK_EQ(r, uint64_t(w) * h * 255);
+		CHECK_EQ(g, uint64_t(w) * h * 255);
+		CHECK_EQ(b, uint64_t(w) * h * 255);
+	}
+
+	// Same for the linear luminance kernels
+	for (const auto &k : sumLinearBGRXKernels())
+	{
+		std::cout << "  linear kernel: " << k.name << '\n';
+
+		for (int i = 0; i < 2000; ++i)
+		{
+			const uint32_t width  = rnd(300);
+			const uint32_t rows   = 1 + rnd(8);
+			const size_t   stride = size_t(width) * 4 + rnd(64);
+			const size_t   offset = rnd(16);
+
+			buf.resize(offset + stride * rows);
+
+			if (rnd(4) == 0) std::fill(buf.begin(), buf.end(), 0xff);
+			else for (auto &v : buf) v = uint8_t(rng());
+
+			const uint64_t init = rng();
+
+			uint64_t y = init, ey = init;
+
+			k.sum(buf.data() + offset, width, rows, stride, y);
+			sumLinearBGRXScalar(buf.data() + offset, width, rows, stride, ey);
+
+			CHECK_EQ(y, ey);
+		}
+
+		// White is exactly 1.0 per pixel, whatever the width of a row
+		constexpr uint32_t w = 3840, h = 2160;
+
+		buf.assign(size_t(w) * h * 4, 0xff);
+
+		uint64_t y = 0;
+		k.sum(buf.data(), w, h, size_t(w) * 4, y);
+
+		CHECK_EQ(y, uint64_t(w) * h << 16);
+	}
+}
@@ -0,0 +1,46 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "test.h"
+#include "analysis.h"
+#include <cstdlib>
+#include <random>
+
+/**
+ * On a noisy frame, a tight bound can't be met with one point per cell.
+ * The sample stage must then fall back to the exact mean instead of returning a loose estimate.
+ */
+void testSampler()
+{
+	constexpr uint32_t w = 1920, h = 1080, stride = w * 4;
+
+	std::vector<uint8_t> buf(size_t(stride) * h);
+
+	std::mt19937 rng(13);
+
+	for (auto &v : buf) v = uint8_t(rng());
+
+	const std::vector<Rect> full { Rect{0, 0, w, h} };
+	const Frame frame { buf.data(), w, h, stride, BGRX32, &full };
+
+	TileGrid grid;
+	const int exact = grid.update(frame);
+
+	for (const double bound : { 0.5, 1.0, 5.0 })
+	{
+		AnalysisSettings s;
+		s.sample_error = bound;
+
+		SampleStage stage;
+		stage.configure(s);
+
+		const int br = stage.process(frame, -1);
+
+		CHECK(std::abs(br - exact) <= int(bound + 0.5));
+
+		// Below what the pattern can reach, the result is exact
+		if (bound < 1.6) CHECK_EQ(br, exact);
+	}
+}
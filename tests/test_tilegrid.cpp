@@ -0,0 +1,103 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "test.h"
+#include "tilegrid.h"
+#include "workerpool.h"
+#include <random>
+
+static uint32_t pixelSize(PixelFormat f)
+{
+	switch (f)
+	{
+	case BGR24:  return Pixel<BGR24>::size;
+	case RGB565: return Pixel<RGB565>::size;
+	case RGB30:  return Pixel<RGB30>::size;
+	default:     return Pixel<BGRX32>::size;
+	}
+}
+
+/**
+ * An incrementally updated grid has to end up with the same brightness as a fresh grid
+ * reading the whole frame, whatever the damage, format, metric and weighting.
+ */
+void testTileGrid()
+{
+	// Not multiples of the tile size, so the edge tiles are partial
+	constexpr uint32_t w = 333, h = 201;
+
+	const PixelFormat formats[] = { BGRX32, BGR24, RGB565, RGB30 };
+	const TileGrid::Metric metrics[] = { TileGrid::MEAN, TileGrid::MEDIAN, TileGrid::P90, TileGrid::GLARE, TileGrid::LIGHTNESS };
+	const TileGrid::Weighting weightings[] = { TileGrid::UNIFORM, TileGrid::CENTER, TileGrid::POINTER };
+
+	std::mt19937 rng(1234);
+
+	const auto rnd = [&] (uint32_t n) { return uint32_t(rng() % n); };
+
+	WorkerPool pool(3);
+
+	for (const auto format : formats)
+	{
+		const uint32_t px     = pixelSize(format);
+		const uint32_t stride = w * px + 12;
+
+		std::vector<uint8_t> buf(size_t(stride) * h);
+
+		for (auto &v : buf) v = uint8_t(rng());
+
+		for (const bool fingerprint : { false, true })
+		{
+			// Kept across metrics and weightings, so switching them is covered too
+			TileGrid grid;
+			grid.setPool(&pool);
+			grid.setFingerprint(fingerprint);
+
+			for (const auto metric : metrics)
+			{
+				for (const auto weighting : weightings)
+				{
+					grid.setMetric(metric, 200);
+					grid.setWeighting(weighting);
+
+					const double fx = rnd(100) / 100.0, fy = rnd(100) / 100.0;
+					grid.setPointer(fx, fy);
+
+					for (int frame = 0; frame < 8; ++frame)
+					{
+						std::vector<Rect> damage;
+
+						for (uint32_t n = rnd(4); n > 0; --n)
+						{
+							const uint32_t x  = rnd(w), y = rnd(h);
+							const uint32_t rw = 1 + rnd(w - x), rh = 1 + rnd(h - y);
+
+							for (uint32_t row = y; row < y + rh; ++row)
+							{
+								for (size_t i = size_t(x) * px; i < size_t(x + rw) * px; ++i) buf[size_t(row) * stride + i] = uint8_t(rng());
+							}
+
+							damage.push_back(Rect{x, y, rw, rh});
+						}
+
+						// Without damage events every frame is fully damaged, and fingerprints find what changed
+						if (fingerprint && rnd(2)) damage.assign(1, Rect{0, 0, w, h});
+
+						const std::vector<Rect> full { Rect{0, 0, w, h} };
+
+						TileGrid fresh;
+						fresh.setMetric(metric, 200);
+						fresh.setWeighting(weighting);
+						fresh.setPointer(fx, fy);
+
+						const int incremental = grid.update(Frame{buf.data(), w, h, stride, format, &damage});
+						const int expected    = fresh.update(Frame{buf.data(), w, h, stride, format, &full});
+
+						CHECK_EQ(incremental, expected);
+					}
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,62 @@
+/**
+ * Copyright (C) 2019 Francesco Fusco. All rights reserved.
+ * License: https://github.com/Fushko/gammy#license
+ */
+
+#include "test.h"
+#include "utils.h"
+#include "defs.h"
+#include <cstdlib>
+#include <random>
+
+// The integer formulas may only differ from the floating point ones they replaced by rounding
+void testUtils()
+{
+	std::mt19937_64 rng(7);
+
+	int lum_off = 0;
+
+	for (int i = 0; i < 100000; ++i)
+	{
+		const uint64_t pixels = 1 + rng() % (3840 * 2160);
+
+		const uint64_t r = rng() % (pixels * 255 + 1);
+		const uint64_t g = rng() % (pixels * 255 + 1);
+		const uint64_t b = rng() % (pixels * 255 + 1);
+
+		const int old = int((r * 0.2126 + g * 0.7152 + b * 0.0722) / pixels);
+		const int now = calcLuminance(r, g, b, pixels);
+
+		CHECK(std::abs(now - old) <= 1);
+
+		lum_off += now != old;
+	}
+
+	// Uniform colors are exact: white stays 255, black 0
+	CHECK_EQ(calcLuminance(255, 255, 255, 1), 255);
+	CHECK_EQ(calcLuminance(0, 0, 0, 1), 0);
+	CHECK_EQ(calcLuminance(1, 1, 1, 0), 0);
+
+	int target_off = 0;
+
+	for (int img_br = 0; img_br <= 255; ++img_br)
+	{
+		for (int offset = 0; offset <= brt_slider_steps; offset += 25)
+		{
+			for (int min_br = 0; min_br <= brt_slider_steps; min_br += 100)
+			{
+				for (int max_br = min_br; max_br <= 2 * brt_slider_steps; max_br += 100)
+				{
+					const int old = clamp(brt_slider_steps - int(remap(img_br, 0, 255, 0, brt_slider_steps)) + offset, min_br, max_br);
+					const int now = calcBrightnessTarget(img_br, offset, min_br, max_br);
+
+					CHECK(std::abs(now - old) <= 1);
+
+					target_off += now != old;
+				}
+			}
+		}
+	}
+
+	std::cout << "  luminance off by one: " << lum_off << ", brightness target off by one: " << target_off << '\n';
+}
@@ -0,0 +1,30 @@
+#-------------------------------------------------
+#
+# Unit tests of the reduction and filtering code. No Qt or X11 needed.
+# Build and run with: qmake && make check
+#
+#-------------------------------------------------
+
+TARGET = tests
+TEMPLATE = app
+
+CONFIG += console c++1z testcase
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ../src ../includes
+
+HEADERS += test.h
+
+SOURCES += main.cpp \
+    test_tilegrid.cpp \
+    test_reduce.cpp \
+    test_utils.cpp \
+    test_brfilter.cpp \
+    test_sampler.cpp \
+    ../src/tilegrid.cpp \
+    ../src/reduce.cpp \
+    ../src/workerpool.cpp \
+    ../src/utils.cpp \
+    ../src/brfilter.cpp \
+    ../src/sampler.cpp \
+    ../src/analysis.cpp